@@ -1,22 +1,73 @@
+newoption {
+	trigger = "profile",
+	description = "Compile profiler zones into Release builds"
+}
+
+newoption {
+	trigger = "gl-debug",
+	description = "Use a GL debug context with KHR_debug output in Release builds"
+}
+
 workspace "Platformer"
 	configurations { "Debug", "Release" }
 
-project "Platformer"
-	kind "ConsoleApp"
 	language "C++"
+	cppdialect "C++17"
 	targetdir "bin/%{cfg.buildcfg}"
 
-	files { "src/main.cpp" }
-
 	filter "configurations:Debug"
-		defines { "DEBUG" }
+		defines { "DEBUG", "PLATFORMER_PROFILE", "PLATFORMER_GL_DEBUG" }
 		symbols "On"
 
 	filter "configurations:Release"
 		optimize "On"
 
+	filter { "configurations:Release", "options:profile" }
+		defines { "PLATFORMER_PROFILE" }
+
+	filter { "configurations:Release", "options:gl-debug" }
+		defines { "PLATFORMER_GL_DEBUG" }
+
 	filter { "system:windows" }
 		architecture "x86_64"
 		includedirs { "libs\\include" }
 		libdirs { "libs\\windows" }
-   		links { "opengl32.lib", "glfw3.lib", "glew32s.lib", "assimp.lib" }
+   		links { "opengl32.lib", "glfw3.lib", "glew32s.lib" }
+
+	-- GLFW, GLEW, EGL and (for Bake) Assimp come from the system packages, build with
+	-- `premake5 gmake2 && make config=release`. Run with --headless on
+	-- machines without a display (Mesa llvmpipe via EGL surfaceless).
+	filter { "system:linux" }
+		architecture "x86_64"
+		includedirs { "libs/include" }
+		links { "glfw", "GLEW", "GL", "EGL", "pthread", "dl" }
+
+	filter {}
+
+project "Platformer"
+	kind "ConsoleApp"
+	files { "src/main.cpp" }
+
+-- scripted rendering scenarios, writes benchmark.json
+project "Benchmark"
+	kind "ConsoleApp"
+	files { "src/benchmark.cpp" }
+
+-- simulation and loading micro benchmarks
+project "Microbench"
+	kind "ConsoleApp"
+	files { "src/microbench.cpp" }
+
+-- imports models once and writes the .mesh files the game loads, the only
+-- project that needs Assimp
+project "Bake"
+	kind "ConsoleApp"
+	files { "src/bake.cpp" }
+
+	filter { "system:windows" }
+		links { "assimp.lib" }
+
+	filter { "system:linux" }
+		links { "assimp" }
+
+	filter {}
@@ -3,10 +3,12 @@
 in vec3 frag_pos;
 in vec2 uv_coord;
 in vec3 normal;
+in vec4 block_color;
+flat in float layer;
 
 out vec4 color;
 
-uniform sampler2D color_palette;
+uniform sampler2DArray materials;
 
 struct PositionalLight {
 	vec4 ambient;
@@ -16,7 +18,6 @@ struct PositionalLight {
 };
 
 uniform PositionalLight light;
-uniform vec4 block_color;
 
 void main() {
 	vec3 ray = normalize(light.pos - frag_pos);
@@ -25,7 +26,7 @@ void main() {
 
 	vec4 diffuse = diff * light.diffuse;
 
-	color = (light.ambient + diffuse) * texture(color_palette, uv_coord) * block_color;
+	color = (light.ambient + diffuse) * texture(materials, vec3(uv_coord, layer)) * block_color;
 
 	color = vec4(pow(color.xyz, vec3(0.4545)), 1.0);
 }
\ No newline at end of file
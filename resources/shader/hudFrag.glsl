@@ -0,0 +1,12 @@
+#version 430 core
+
+in vec2 frag_uv;
+in vec4 frag_color;
+
+out vec4 color;
+
+uniform sampler2D font;
+
+void main() {
+	color = vec4(frag_color.rgb, frag_color.a * texture(font, frag_uv).r);
+}
\ No newline at end of file
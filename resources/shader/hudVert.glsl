@@ -0,0 +1,18 @@
+#version 430 core
+
+layout (location = 0) in vec2 pos;
+layout (location = 1) in vec2 uv;
+layout (location = 2) in vec4 color;
+
+out vec2 frag_uv;
+out vec4 frag_color;
+
+uniform vec2 screen_size;
+
+void main() {
+	vec2 ndc = pos / screen_size * 2.0 - 1.0;
+	gl_Position = vec4(ndc.x, -ndc.y, 0.0, 1.0);
+
+	frag_uv = uv;
+	frag_color = color;
+}
\ No newline at end of file
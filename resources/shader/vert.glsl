@@ -2,18 +2,37 @@
 
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec2 texture_coords;
+layout (location = 3) in mat4 model_matrix;
+layout (location = 7) in vec4 instance_color;
+layout (location = 8) in float instance_layer;
+/* the mesh format's normals, the program is compiled for one of them */
+#ifdef MESH_QUANTIZED
+layout (location = 9) in vec2 octahedral_normal;
+#else
 layout (location = 2) in vec3 in_normal;
+#endif
 
 out vec3 frag_pos;
 out vec2 uv_coord;
 out vec3 normal;
+out vec4 block_color;
+flat out float layer;
 
 uniform mat4 proj_matrix;
 uniform mat4 view_matrix;
-uniform mat4 model_matrix;
 
 const vec4 plane = vec4(0.0, -1.0, 0.0, 0.7);
 
+#ifdef MESH_QUANTIZED
+vec3 octahedral_decode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+#endif
+
 void main() {
 	vec4 world_pos = model_matrix * vec4(pos, 1.0);
 
@@ -23,5 +42,12 @@ void main() {
 
 	frag_pos = pos;
 	uv_coord = texture_coords;
-	normal = mat3(transpose(inverse(model_matrix))) * in_normal; 
+#ifdef MESH_QUANTIZED
+	vec3 mesh_normal = octahedral_decode(octahedral_normal);
+#else
+	vec3 mesh_normal = in_normal;
+#endif
+	normal = mat3(transpose(inverse(model_matrix))) * mesh_normal;
+	block_color = instance_color;
+	layer = instance_layer;
 }
\ No newline at end of file
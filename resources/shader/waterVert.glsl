@@ -1,13 +1,13 @@
 #version 430 core
 
 layout (location = 0) in vec3 pos;
+layout (location = 3) in mat4 model_matrix;
 
 out vec2 uv_coords;
 out vec4 clip_space;
 
 uniform mat4 proj_matrix;
 uniform mat4 view_matrix;
-uniform mat4 model_matrix;
 
 const float tiling = 6.0;
 
@@ -0,0 +1,426 @@
+/*
+ * Asynchronous asset loading. A request is split in two halves: work runs on
+ * a job worker and does everything that burns CPU (decoding images, parsing
+ * and optimizing meshes) without touching GL, on files read beforehand by
+ * async I/O, then finish runs on the GL thread inside asset_loader_update. Updates stop once
+ * their time budget is spent, so loading while the game runs never stalls a
+ * frame for long.
+ *
+ * Pixels and vertices are copied into a persistently mapped staging buffer
+ * and the GPU fills the texture or buffer from there (a pixel unpack or copy
+ * read buffer), so no upload copies client memory on the GL thread. Staging
+ * is a StreamBuffer, a region is reused once the fence of its uploads
+ * signals. Items larger than a region upload directly. The buffer is only
+ * created while requests are pending and released once they have all
+ * finished, so an idle loader holds no staging memory.
+ */
+#define ASSET_STAGING_SIZE (16 * 1024 * 1024) /* per region */
+#define ASSET_STAGING_ALIGNMENT 16
+#define ASSET_UPLOAD_BUDGET_MS 2.0
+
+struct AssetLoader;
+
+struct AssetJob {
+	std::function<size_t()> work; /* returns the bytes finish will stage */
+	std::function<void(AssetLoader *)> finish;
+	size_t staging_bytes;
+	double work_ms;
+};
+
+struct AssetLoader {
+	StreamBuffer *staging = 0;
+
+	std::mutex mutex;
+	std::condition_variable completed_signal;
+	std::deque<AssetJob *> completed; /* work done, finish still to run */
+	int pending = 0; /* requested and not finished, GL thread only */
+
+	/* since the loader was last idle */
+	int loaded = 0;
+	double started = 0.0;
+	double work_ms = 0.0;
+	double finish_ms = 0.0;
+};
+
+AssetJob *asset_job(AssetLoader *loader, std::function<size_t()> work, std::function<void(AssetLoader *)> finish) {
+	if (loader->pending == 0 && loader->loaded == 0) {
+		loader->started = platform_clock();
+	}
+	loader->pending++;
+
+	AssetJob *job = new AssetJob();
+	job->work = std::move(work);
+	job->finish = std::move(finish);
+	return job;
+}
+
+/* runs work on a worker and queues the job for its finish */
+void asset_submit(AssetLoader *loader, AssetJob *job) {
+	jobs_submit([loader, job] {
+		double start = platform_clock();
+		job->staging_bytes = job->work();
+		job->work_ms = (platform_clock() - start) * 1000.0;
+
+		{
+			std::lock_guard<std::mutex> lock(loader->mutex);
+			loader->completed.push_back(job);
+		}
+		loader->completed_signal.notify_one();
+	});
+}
+
+struct AssetFiles {
+	std::vector<VfsFile> files;
+	std::atomic<int> remaining;
+};
+
+/*
+ * Queues a request. The files at paths are read asynchronously first and
+ * work starts on a worker once the last one is in, so no worker blocks on
+ * the disk. work gets them in the order of paths, a file that could not be
+ * read is empty (null data), and they are closed after it returns unless
+ * work took one over. work must not touch GL, finish runs on the GL thread
+ * once work is done; whatever they share lives in what the two capture.
+ */
+void asset_request_files(AssetLoader *loader, const std::vector<std::string> &paths, std::function<size_t(VfsFile *)> work,
+	std::function<void(AssetLoader *)> finish) {
+	AssetFiles *files = new AssetFiles();
+	files->files.resize(paths.size());
+	files->remaining = paths.size();
+
+	AssetJob *job = asset_job(loader, [files, work] {
+		size_t staging_bytes = work(files->files.data());
+		for (VfsFile &file : files->files) {
+			vfs_close(&file);
+		}
+		delete files;
+		return staging_bytes;
+	}, std::move(finish));
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		vfs_open_async(paths[i].c_str(), [loader, job, files, i](VfsFile *file) {
+			files->files[i] = *file;
+			if (files->remaining.fetch_sub(1) == 1) {
+				asset_submit(loader, job);
+			}
+		});
+	}
+}
+
+/* bytes a staged item takes up, with the alignment */
+size_t asset_staging_size(size_t bytes) {
+	return (bytes + ASSET_STAGING_ALIGNMENT - 1) / ASSET_STAGING_ALIGNMENT * ASSET_STAGING_ALIGNMENT;
+}
+
+/*
+ * Copies bytes into the staging buffer and returns their offset in it, false
+ * if they do not fit and have to be uploaded straight from memory. Only
+ * valid inside finish.
+ */
+bool asset_stage(AssetLoader *loader, const void *data, size_t bytes, size_t *offset) {
+	size_t count = asset_staging_size(bytes) / ASSET_STAGING_ALIGNMENT;
+	if (!loader->staging->fits(count, ASSET_STAGING_ALIGNMENT)) {
+		return false;
+	}
+
+	GLuint first;
+	void *staged = loader->staging->alloc(count, ASSET_STAGING_ALIGNMENT, &first);
+	memcpy(staged, data, bytes);
+
+	*offset = (size_t)first * ASSET_STAGING_ALIGNMENT;
+	return true;
+}
+
+/* runs finished requests until budget_ms is spent, all of them if it is 0 */
+void asset_loader_update(AssetLoader *loader, double budget_ms) {
+	if (loader->pending == 0) {
+		return;
+	}
+
+	PROFILE_ZONE("asset_loader_update");
+
+	double start = platform_clock();
+
+	if (!loader->staging) {
+		loader->staging = new StreamBuffer(ASSET_STAGING_SIZE);
+		gl_label(GL_BUFFER, loader->staging->buffer, "asset staging");
+	}
+	loader->staging->begin_frame();
+
+	while (true) {
+		AssetJob *job;
+
+		{
+			std::lock_guard<std::mutex> lock(loader->mutex);
+			if (loader->completed.empty()) {
+				break;
+			}
+
+			/* wait for the next region rather than upload directly what fits in an empty one */
+			job = loader->completed.front();
+			size_t count = asset_staging_size(job->staging_bytes) / ASSET_STAGING_ALIGNMENT;
+			if (job->staging_bytes <= ASSET_STAGING_SIZE && !loader->staging->fits(count, ASSET_STAGING_ALIGNMENT)) {
+				break;
+			}
+
+			loader->completed.pop_front();
+		}
+
+		double finish_start = platform_clock();
+		job->finish(loader);
+		double now = platform_clock();
+
+		loader->finish_ms += (now - finish_start) * 1000.0;
+		loader->work_ms += job->work_ms;
+		loader->loaded++;
+		loader->pending--;
+		delete job;
+
+		if (budget_ms > 0.0 && (now - start) * 1000.0 >= budget_ms) {
+			break;
+		}
+	}
+
+	loader->staging->end_frame();
+
+	if (loader->pending == 0) {
+		LOG(LOG_INFO, "Assets loaded", log_int("count", loader->loaded), log_float("wall_ms", (platform_clock() - loader->started) * 1000.0),
+			log_float("work_ms", loader->work_ms), log_float("finish_ms", loader->finish_ms));
+
+		loader->loaded = 0;
+		loader->work_ms = 0.0;
+		loader->finish_ms = 0.0;
+
+		/* GL keeps the buffer alive for uploads still in flight */
+		delete loader->staging;
+		loader->staging = 0;
+	}
+}
+
+/* blocks until every request so far has finished */
+void asset_loader_finish(AssetLoader *loader) {
+	PROFILE_ZONE("asset_loader_finish");
+
+	while (loader->pending > 0) {
+		{
+			std::unique_lock<std::mutex> lock(loader->mutex);
+			loader->completed_signal.wait(lock, [loader] { return !loader->completed.empty(); });
+		}
+
+		asset_loader_update(loader, 0.0);
+	}
+}
+
+void asset_loader_destroy(AssetLoader *loader) {
+	asset_loader_finish(loader);
+	delete loader->staging;
+	loader->staging = 0;
+}
+
+/* every layer's bake when they all have a usable one, the decoded sources otherwise */
+struct PreparedTexture {
+	std::vector<std::string> paths;
+	GLenum target;
+	std::vector<BakedTexture> baked;
+	Image image;
+};
+
+/* takes over the bakes read into files, leaves baked empty when a layer has no usable one */
+size_t prepare_baked_texture(PreparedTexture *texture, VfsFile *files) {
+	std::vector<const char *> paths;
+	for (const std::string &path : texture->paths) {
+		paths.push_back(path.c_str());
+	}
+
+	texture->baked.resize(paths.size());
+	if (open_baked_textures(paths.data(), paths.size(), files, texture->baked.data())) {
+		return asset_staging_size(texture->baked[0].header->data_size) * paths.size();
+	}
+	texture->baked.clear();
+	return 0;
+}
+
+/* decodes the sources read into files */
+size_t prepare_source_texture(PreparedTexture *texture, const VfsFile *files) {
+	std::vector<const char *> paths;
+	for (const std::string &path : texture->paths) {
+		paths.push_back(path.c_str());
+	}
+
+	bool decoded = texture->target == GL_TEXTURE_2D ? decode_image_file(paths[0], &files[0], &texture->image) : decode_image_array(paths.data(), paths.size(), files, &texture->image);
+	return decoded ? image_bytes(&texture->image) : 0;
+}
+
+Texture upload_texture(AssetLoader *loader, PreparedTexture *texture) {
+	const char *label = texture->paths[0].c_str();
+	size_t offset;
+
+	if (texture->baked.empty()) {
+		Image *image = &texture->image;
+		if (!image->pixels) {
+			die("Failed to load texture!");
+		}
+
+		if (!asset_stage(loader, image->pixels, image_bytes(image), &offset)) {
+			return create_texture(image, texture->target, image->pixels, label);
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader->staging->buffer);
+		Texture id = create_texture(image, texture->target, (const void *)offset, label);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return id;
+	}
+
+	std::vector<const unsigned char *> mapped, staged;
+	for (const BakedTexture &layer : texture->baked) {
+		mapped.push_back(layer.data);
+		if (asset_stage(loader, layer.data, layer.header->data_size, &offset)) {
+			staged.push_back((const unsigned char *)offset);
+		}
+	}
+
+	const TextureHeader *header = texture->baked[0].header;
+	if (staged.size() != mapped.size()) {
+		return create_baked_texture(header, texture->target, mapped.data(), mapped.size(), label);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader->staging->buffer);
+	Texture id = create_baked_texture(header, texture->target, staged.data(), staged.size(), label);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return id;
+}
+
+void release_prepared_texture(PreparedTexture *texture) {
+	for (BakedTexture &layer : texture->baked) {
+		close_baked_texture(&layer);
+	}
+	free_image(&texture->image);
+}
+
+void finish_texture(AssetLoader *loader, PreparedTexture *texture, std::function<void(Texture)> done) {
+	Texture id = upload_texture(loader, texture);
+	release_prepared_texture(texture);
+	delete texture;
+	done(id);
+}
+
+/*
+ * A GL_TEXTURE_2D from one path, a GL_TEXTURE_2D_ARRAY from several. Only
+ * the bakes are read at first; when a layer has none that is usable, the
+ * sources are read and decoded by a second request.
+ */
+void request_texture_layers(AssetLoader *loader, const char **paths, int count, GLenum target, std::function<void(Texture)> done) {
+	PreparedTexture *texture = new PreparedTexture();
+	texture->paths.assign(paths, paths + count);
+	texture->target = target;
+
+	std::vector<std::string> baked_paths;
+	for (const std::string &path : texture->paths) {
+		baked_paths.push_back(baked_texture_path(path.c_str()));
+	}
+
+	asset_request_files(loader, baked_paths, [texture](VfsFile *files) {
+		return prepare_baked_texture(texture, files);
+	}, [texture, done](AssetLoader *bake_loader) {
+		if (!texture->baked.empty()) {
+			finish_texture(bake_loader, texture, done);
+			return;
+		}
+
+		asset_request_files(bake_loader, texture->paths, [texture](VfsFile *files) {
+			return prepare_source_texture(texture, files);
+		}, [texture, done](AssetLoader *source_loader) {
+			finish_texture(source_loader, texture, done);
+		});
+	});
+}
+
+void request_texture(AssetLoader *loader, const char *path, std::function<void(Texture)> done) {
+	request_texture_layers(loader, &path, 1, GL_TEXTURE_2D, done);
+}
+
+void request_texture_array(AssetLoader *loader, const char **paths, int count, std::function<void(Texture)> done) {
+	request_texture_layers(loader, paths, count, GL_TEXTURE_2D_ARRAY, done);
+}
+
+void finish_mesh(AssetLoader *loader, const std::string &path, PreparedMesh *prepared, std::function<void(ComplexModel *)> done) {
+	if (!prepared->data) {
+		die("Failed to load mesh!");
+	}
+
+	ComplexModel *model;
+	size_t offset;
+	if (asset_stage(loader, prepared->data, prepared->size, &offset)) {
+		model = create_mesh(prepared, 0, path.c_str());
+		glBindBuffer(GL_COPY_READ_BUFFER, loader->staging->buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, model->buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, prepared->size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	} else {
+		model = create_mesh(prepared, prepared->data, path.c_str());
+	}
+
+	release_prepared_mesh(prepared);
+	delete prepared;
+	done(model);
+}
+
+/* reads the bake first and the source only when the bake is missing or unusable, like request_texture_layers */
+void request_mesh(AssetLoader *loader, const char *source_path, int format, std::function<void(ComplexModel *)> done) {
+	std::string path = source_path;
+	PreparedMesh *prepared = new PreparedMesh();
+
+	asset_request_files(loader, { baked_mesh_path(source_path) }, [path, format, prepared](VfsFile *files) {
+		return prepare_baked_mesh(path.c_str(), format, &files[0], prepared) ? prepared->size : 0;
+	}, [path, format, prepared, done](AssetLoader *bake_loader) {
+		if (prepared->data) {
+			finish_mesh(bake_loader, path, prepared, done);
+			return;
+		}
+
+		asset_request_files(bake_loader, { path }, [path, format, prepared](VfsFile *files) {
+			return prepare_source_mesh(path.c_str(), format, &files[0], prepared) ? prepared->size : 0;
+		}, [path, prepared, done](AssetLoader *source_loader) {
+			finish_mesh(source_loader, path, prepared, done);
+		});
+	});
+}
+
+/* the text of a file read for a request, empty (and reported) when it could not be read */
+std::string asset_text(const std::string &path, const VfsFile *file) {
+	if (!file->data) {
+		LOG(LOG_ERROR, "Failed to read file", log_str("path", path.c_str()));
+		return std::string();
+	}
+
+	return std::string((const char *)file->data, file->size);
+}
+
+struct ShaderSources {
+	std::string vert_path;
+	std::string frag_path;
+	std::string defines;
+	std::string vert;
+	std::string frag;
+};
+
+/*
+ * Only reading the sources is off the GL thread, compiling is the driver's.
+ * defines (null for none) go into both stages, to compile a permutation.
+ */
+void request_shader(AssetLoader *loader, const char *vert_path, const char *frag_path, const char *defines, std::function<void(Shader *)> done) {
+	ShaderSources *sources = new ShaderSources();
+	sources->vert_path = vert_path;
+	sources->frag_path = frag_path;
+	sources->defines = defines ? defines : "";
+
+	asset_request_files(loader, { sources->vert_path, sources->frag_path }, [sources](VfsFile *files) {
+		sources->vert = shader_with_defines(asset_text(sources->vert_path, &files[0]), sources->defines.c_str());
+		sources->frag = shader_with_defines(asset_text(sources->frag_path, &files[1]), sources->defines.c_str());
+		return (size_t)0;
+	}, [sources, done](AssetLoader *) {
+		done(new Shader(sources->vert, sources->frag, sources->vert_path.c_str(), sources->frag_path.c_str()));
+		delete sources;
+	});
+}
@@ -0,0 +1,589 @@
+/*
+ * Asynchronous whole-file reads for loading while the game runs. On Linux
+ * the reads go through io_uring, driven by one I/O thread: requests queued
+ * since it last woke are submitted as one batch, the kernel does the reads
+ * and completions are reaped in bulk, so no thread sits blocked in read().
+ * The ring is set up with raw syscalls, there is no liburing to link.
+ *
+ * Files up to IO_BUFFER_SIZE land in one of a fixed set of buffers
+ * registered with the ring once, the kernel skips mapping their pages on
+ * every read; larger files, and small ones when every buffer is taken, get
+ * a buffer of their own. Where io_uring is missing or not allowed the same
+ * reads are a pread on a job worker.
+ *
+ * done runs on the I/O thread or a job worker and must be quick, heavier
+ * work on the bytes belongs in a job of its own. It gets the buffer, null
+ * if the file could not be read, and hands it back with async_release once
+ * it is done with the bytes. Like vfs_open, a file that does not open is
+ * for the caller to report, some (bakes) are optional.
+ */
+#define IO_QUEUE_DEPTH 64
+#define IO_BUFFER_COUNT 16
+#define IO_BUFFER_SIZE (256 * 1024)
+#define IO_MAX_READ (1 << 30) /* per read, a larger file takes several */
+
+struct IoBuffer {
+	unsigned char *data;
+	size_t size;
+	int slot; /* the registered buffer, -1 for one of its own */
+};
+
+struct IoRequest {
+	std::string path;
+	std::function<void(IoBuffer *)> done;
+	int fd;
+	IoBuffer *buffer;
+	size_t offset; /* read so far */
+};
+
+#ifdef __linux__
+struct IoRing {
+	int fd;
+	unsigned entries;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_map;
+	size_t sq_map_size;
+	void *cq_map; /* the same as sq_map with IORING_FEAT_SINGLE_MMAP */
+	size_t cq_map_size;
+	size_t sqes_size;
+
+	bool fixed_buffers; /* the slots are registered */
+	unsigned unsubmitted; /* queued in the ring, not yet taken by the kernel */
+};
+
+/* user_data of the read that wakes the I/O thread */
+#define IO_WAKE_TAG 0
+#endif
+
+struct AsyncIo {
+	std::mutex mutex;
+	bool started;
+	bool stopping;
+	bool uring;
+	bool disable_uring; /* use the pread backend even where io_uring works */
+
+	unsigned char *slot_memory;
+	IoBuffer slots[IO_BUFFER_COUNT];
+	std::vector<int> free_slots;
+
+	/* io_uring backend */
+	std::deque<IoRequest *> queued;
+	std::thread thread;
+#ifdef __linux__
+	IoRing ring;
+	int wake_fd;
+	uint64_t wake_value;
+#endif
+
+	std::atomic<uint64_t> reads;
+	std::atomic<uint64_t> bytes;
+};
+
+static AsyncIo async_io;
+
+/* a registered buffer when the file fits one and one is free, a buffer of its own otherwise */
+IoBuffer *io_buffer(size_t size) {
+	if (size <= IO_BUFFER_SIZE) {
+		std::lock_guard<std::mutex> lock(async_io.mutex);
+		if (!async_io.free_slots.empty()) {
+			IoBuffer *buffer = &async_io.slots[async_io.free_slots.back()];
+			async_io.free_slots.pop_back();
+			buffer->size = size;
+			return buffer;
+		}
+	}
+
+	IoBuffer *buffer = new IoBuffer();
+	buffer->data = (unsigned char *)mem_alloc(MEM_GENERAL, std::max(size, (size_t)1));
+	buffer->size = size;
+	buffer->slot = -1;
+	return buffer;
+}
+
+void async_release(IoBuffer *buffer) {
+	if (!buffer) {
+		return;
+	}
+
+	if (buffer->slot >= 0) {
+		std::lock_guard<std::mutex> lock(async_io.mutex);
+		async_io.free_slots.push_back(buffer->slot);
+		return;
+	}
+
+	mem_free(buffer->data);
+	delete buffer;
+}
+
+/* a read-only descriptor, -1 if there is no such file */
+int io_file_open(const char *path) {
+#ifdef _WIN32
+	return _open(path, _O_RDONLY | _O_BINARY);
+#else
+	return open(path, O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+bool io_file_size(int fd, size_t *size) {
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_fstat64(fd, &st) != 0) {
+		return false;
+	}
+#else
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		return false;
+	}
+#endif
+
+	*size = st.st_size;
+	return true;
+}
+
+void io_file_close(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+/* opens the request's file and sizes its buffer, false if there is no such file */
+bool io_open(IoRequest *request) {
+	request->buffer = 0;
+	request->offset = 0;
+
+	request->fd = io_file_open(request->path.c_str());
+	if (request->fd < 0) {
+		return false;
+	}
+
+	size_t size;
+	if (!io_file_size(request->fd, &size)) {
+		io_file_close(request->fd);
+		return false;
+	}
+
+	request->buffer = io_buffer(size);
+	return true;
+}
+
+/* closes the file and runs done, with the buffer if every byte arrived */
+void io_complete(IoRequest *request, bool ok) {
+	io_file_close(request->fd);
+
+	if (!ok) {
+		LOG(LOG_ERROR, "Failed to read file", log_str("path", request->path.c_str()));
+		async_release(request->buffer);
+		request->buffer = 0;
+	} else {
+		async_io.reads.fetch_add(1, std::memory_order_relaxed);
+		async_io.bytes.fetch_add(request->buffer->size, std::memory_order_relaxed);
+	}
+
+	request->done(request->buffer);
+	delete request;
+}
+
+/* the fallback backend, the whole read on a job worker */
+void io_read_blocking(IoRequest *request) {
+	if (!io_open(request)) {
+		request->done(0);
+		delete request;
+		return;
+	}
+
+	IoBuffer *buffer = request->buffer;
+	while (request->offset < buffer->size) {
+		size_t length = std::min(buffer->size - request->offset, (size_t)IO_MAX_READ);
+#ifdef _WIN32
+		_lseeki64(request->fd, request->offset, SEEK_SET);
+		long result = _read(request->fd, buffer->data + request->offset, (unsigned)length);
+#else
+		ssize_t result = pread(request->fd, buffer->data + request->offset, length, request->offset);
+		if (result < 0 && errno == EINTR) {
+			continue;
+		}
+#endif
+		if (result <= 0) {
+			break;
+		}
+		request->offset += result;
+	}
+
+	io_complete(request, request->offset == buffer->size);
+}
+
+#ifdef __linux__
+int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+void io_ring_destroy(IoRing *ring) {
+	if (ring->sqes) {
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_map && ring->cq_map != ring->sq_map) {
+		munmap(ring->cq_map, ring->cq_map_size);
+	}
+	if (ring->sq_map) {
+		munmap(ring->sq_map, ring->sq_map_size);
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+/* false when the kernel has no io_uring, refuses it, or lacks what the reads need */
+bool io_ring_init(IoRing *ring, unsigned entries) {
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ring->fd = sys_io_uring_setup(entries, &params);
+	if (ring->fd < 0) {
+		return false;
+	}
+
+	/* plain IORING_OP_READ arrived in the same kernel */
+	if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+		io_ring_destroy(ring);
+		return false;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (single_map) {
+		ring->sq_map_size = ring->cq_map_size = std::max(ring->sq_map_size, ring->cq_map_size);
+	}
+
+	ring->sq_map = mmap(0, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED) {
+		ring->sq_map = 0;
+		io_ring_destroy(ring);
+		return false;
+	}
+
+	ring->cq_map = single_map ? ring->sq_map : mmap(0, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	if (ring->cq_map == MAP_FAILED) {
+		ring->cq_map = 0;
+		io_ring_destroy(ring);
+		return false;
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		io_ring_destroy(ring);
+		return false;
+	}
+	ring->sqes = (struct io_uring_sqe *)sqes;
+
+	unsigned char *sq = (unsigned char *)ring->sq_map;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+
+	unsigned char *cq = (unsigned char *)ring->cq_map;
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return true;
+}
+
+/*
+ * Queues a read for the next io_uring_enter; the caller keeps what is in
+ * flight within the ring's entries. buf_index is the registered buffer for
+ * IORING_OP_READ_FIXED.
+ */
+void io_ring_read(IoRing *ring, int opcode, int fd, void *data, unsigned length, uint64_t offset, int buf_index, uint64_t user_data) {
+	unsigned tail = *ring->sq_tail;
+	unsigned index = tail & *ring->sq_mask;
+
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)data;
+	sqe->len = length;
+	sqe->off = offset;
+	sqe->buf_index = buf_index;
+	sqe->user_data = user_data;
+	ring->sq_array[index] = index;
+
+	/* the kernel must see the entry before the tail that publishes it */
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->unsubmitted++;
+}
+
+/* queues the next part of the request's file */
+void io_submit_read(IoRing *ring, IoRequest *request) {
+	IoBuffer *buffer = request->buffer;
+	unsigned length = std::min(buffer->size - request->offset, (size_t)IO_MAX_READ);
+	bool fixed = buffer->slot >= 0 && ring->fixed_buffers;
+
+	io_ring_read(ring, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, request->fd, buffer->data + request->offset, length, request->offset,
+		fixed ? buffer->slot : 0, (uint64_t)(uintptr_t)request);
+}
+
+void io_arm_wake(IoRing *ring) {
+	io_ring_read(ring, IORING_OP_READ, async_io.wake_fd, &async_io.wake_value, sizeof(async_io.wake_value), 0, 0, IO_WAKE_TAG);
+}
+
+void async_io_main() {
+	IoRing *ring = &async_io.ring;
+	std::deque<IoRequest *> waiting; /* opened, waiting for room in the ring */
+	unsigned in_flight = 0; /* file reads, the wake read is extra */
+
+	io_arm_wake(ring);
+
+	while (true) {
+		bool stopping;
+		{
+			std::lock_guard<std::mutex> lock(async_io.mutex);
+			stopping = async_io.stopping;
+			while (!async_io.queued.empty()) {
+				waiting.push_back(async_io.queued.front());
+				async_io.queued.pop_front();
+			}
+		}
+
+		while (!waiting.empty() && in_flight + 1 < ring->entries) {
+			IoRequest *request = waiting.front();
+			waiting.pop_front();
+
+			if (!io_open(request)) {
+				request->done(0);
+				delete request;
+			} else if (request->buffer->size == 0) {
+				io_complete(request, true);
+			} else {
+				io_submit_read(ring, request);
+				in_flight++;
+			}
+		}
+
+		if (stopping && in_flight == 0 && waiting.empty()) {
+			break;
+		}
+
+		/* hand the whole batch over and sleep until something completes */
+		int submitted = sys_io_uring_enter(ring->fd, ring->unsubmitted, 1, IORING_ENTER_GETEVENTS);
+		if (submitted < 0) {
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+				die("io_uring_enter failed!");
+			}
+		} else {
+			ring->unsubmitted -= submitted;
+		}
+
+		unsigned head = *ring->cq_head;
+		unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+			if (cqe->user_data == IO_WAKE_TAG) {
+				io_arm_wake(ring);
+				continue;
+			}
+
+			IoRequest *request = (IoRequest *)(uintptr_t)cqe->user_data;
+			if (cqe->res == -EINTR || cqe->res == -EAGAIN) {
+				io_submit_read(ring, request);
+				continue;
+			}
+
+			/* a file that shrank since it was opened comes back short */
+			if (cqe->res > 0) {
+				request->offset += cqe->res;
+				if (request->offset < request->buffer->size) {
+					io_submit_read(ring, request);
+					continue;
+				}
+			}
+
+			in_flight--;
+			io_complete(request, cqe->res > 0);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+void async_io_wake() {
+	uint64_t one = 1;
+	ssize_t written = write(async_io.wake_fd, &one, sizeof(one));
+	(void)written;
+}
+
+/* the ring, its registered buffers and the thread driving it; false leaves the pread backend */
+bool async_io_start_uring() {
+	if (async_io.disable_uring || !io_ring_init(&async_io.ring, IO_QUEUE_DEPTH)) {
+		return false;
+	}
+
+	async_io.wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (async_io.wake_fd < 0) {
+		io_ring_destroy(&async_io.ring);
+		return false;
+	}
+
+	/* pinning the buffers can fail under a low RLIMIT_MEMLOCK, they are then read into like any other */
+	struct iovec iovecs[IO_BUFFER_COUNT];
+	for (int i = 0; i < IO_BUFFER_COUNT; ++i) {
+		iovecs[i].iov_base = async_io.slots[i].data;
+		iovecs[i].iov_len = IO_BUFFER_SIZE;
+	}
+	async_io.ring.fixed_buffers = sys_io_uring_register(async_io.ring.fd, IORING_REGISTER_BUFFERS, iovecs, IO_BUFFER_COUNT) == 0;
+
+	async_io.thread = std::thread(async_io_main);
+	return true;
+}
+#endif
+
+/* the first read starts the backend, the caller holds the lock */
+void async_io_start() {
+	async_io.started = true;
+	async_io.stopping = false;
+
+	async_io.slot_memory = (unsigned char *)mem_alloc(MEM_GENERAL, (size_t)IO_BUFFER_COUNT * IO_BUFFER_SIZE);
+	async_io.free_slots.clear();
+	for (int i = 0; i < IO_BUFFER_COUNT; ++i) {
+		async_io.slots[i].data = async_io.slot_memory + (size_t)i * IO_BUFFER_SIZE;
+		async_io.slots[i].size = 0;
+		async_io.slots[i].slot = i;
+		async_io.free_slots.push_back(IO_BUFFER_COUNT - 1 - i);
+	}
+
+	async_io.reads = 0;
+	async_io.bytes = 0;
+
+	bool fixed_buffers = false;
+#ifdef __linux__
+	async_io.uring = async_io_start_uring();
+	fixed_buffers = async_io.uring && async_io.ring.fixed_buffers;
+#else
+	async_io.uring = false;
+#endif
+
+	LOG(LOG_INFO, "Started async I/O", log_str("backend", async_io.uring ? "io_uring" : "pread"), log_int("fixed_buffers", fixed_buffers));
+}
+
+/* reads the whole file at path without blocking the caller, safe on any thread */
+void async_read(const char *path, std::function<void(IoBuffer *)> done) {
+	IoRequest *request = new IoRequest();
+	request->path = path;
+	request->done = std::move(done);
+
+	{
+		std::lock_guard<std::mutex> lock(async_io.mutex);
+		if (!async_io.started) {
+			async_io_start();
+		}
+
+		if (async_io.uring) {
+			async_io.queued.push_back(request);
+		}
+	}
+
+#ifdef __linux__
+	if (async_io.uring) {
+		async_io_wake();
+		return;
+	}
+#endif
+
+	jobs_submit([request] {
+		io_read_blocking(request);
+	});
+}
+
+/*
+ * Finishes what was requested and stops the I/O thread. Buffers still held
+ * are gone afterwards, so everything that read must be done with its bytes;
+ * pread reads finish with jobs_shutdown, which has to come first.
+ */
+void async_io_shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(async_io.mutex);
+		if (!async_io.started) {
+			return;
+		}
+		async_io.stopping = true;
+	}
+
+#ifdef __linux__
+	if (async_io.uring) {
+		async_io_wake();
+		async_io.thread.join();
+		io_ring_destroy(&async_io.ring);
+		close(async_io.wake_fd);
+	}
+#endif
+
+	if (async_io.free_slots.size() != IO_BUFFER_COUNT) {
+		LOG(LOG_WARNING, "Async I/O buffers still held", log_int("count", IO_BUFFER_COUNT - async_io.free_slots.size()));
+	}
+
+	mem_free(async_io.slot_memory);
+	async_io.slot_memory = 0;
+	async_io.started = false;
+
+	LOG(LOG_INFO, "Stopped async I/O", log_int("reads", async_io.reads.load()), log_int("bytes", async_io.bytes.load()));
+}
+
+/*
+ * vfs_open without blocking the caller. A pack entry is opened on a job
+ * worker, as it may need decompressing; a loose file is read through
+ * async_read instead of mapped. done gets the file and owns it, it is empty
+ * when the file could not be read.
+ */
+void vfs_open_async(const char *path, std::function<void(VfsFile *)> done) {
+	if (vfs_in_pack(path)) {
+		std::string pack_path = path;
+		jobs_submit([pack_path, done] {
+			VfsFile file;
+			vfs_open(pack_path.c_str(), &file);
+			done(&file);
+		});
+		return;
+	}
+
+	async_read(path, [done](IoBuffer *buffer) {
+		VfsFile file;
+		vfs_clear(&file);
+		if (buffer) {
+			file.data = buffer->data;
+			file.size = buffer->size;
+			file.read = buffer;
+		}
+		done(&file);
+	});
+}
@@ -0,0 +1,341 @@
+/*
+ * Offline asset bake. Imports models and textures and writes the .mesh and
+ * .tex files the game maps at startup; bakes that are still fresh are
+ * skipped. Models named on the command line are baked to --format
+ * (quantized by default), images (.png) to --texture-format (bc1 for opaque
+ * images and bc3 otherwise by default). OBJ files use the native loader,
+ * anything else goes through Assimp, which only this tool links. Every mesh
+ * is optimized before it is written and its vertex cache stats are logged
+ * before and after. --compare checks the native loader against Assimp
+ * instead of baking. --pack then writes everything under resources into one
+ * pack the game mounts instead of the loose files.
+ *
+ *   Bake [--force] [--compare] [--format float|quantized] [--texture-format rgba8|bc1|bc3] [--pack out.pak] [model or image...]
+ */
+#define PLATFORMER_NO_MAIN
+#define PLATFORMER_USE_ASSIMP
+#include "main.cpp"
+
+struct BakeSource {
+	const char *path;
+	int format;
+};
+
+/* every model the game loads, in the vertex format load_resources asks for */
+const BakeSource default_sources[] = {
+	{ "resources/models/cube.obj", MESH_FORMAT_QUANTIZED },
+	{ "resources/models/crate.obj", MESH_FORMAT_QUANTIZED },
+	{ "resources/models/player.obj", MESH_FORMAT_QUANTIZED },
+	{ "resources/models/crab.obj", MESH_FORMAT_QUANTIZED }
+};
+
+/* picks bc1 or bc3 by whether the image has any transparency */
+#define TEXTURE_FORMAT_AUTO -1
+
+struct TextureBakeSource {
+	const char *path;
+	int format;
+	const char *array; /* sources naming the same array are its layers, null for a texture of its own */
+};
+
+/*
+ * every texture the game loads. The materials array holds colors.png as a
+ * palette, which block compression would shift, and all layers of an array
+ * share one format, so both stay RGBA8. They share a size too, the largest
+ * of their sources', which the smaller ones are scaled to (nearest
+ * neighbour keeps the palette's colors).
+ */
+const TextureBakeSource default_textures[] = {
+	{ "resources/textures/cube.png", TEXTURE_FORMAT_RGBA8, "materials" },
+	{ "resources/textures/colors.png", TEXTURE_FORMAT_RGBA8, "materials" },
+	{ "resources/textures/water_texture.png", TEXTURE_FORMAT_BC1, 0 }
+};
+
+bool mesh_bake_is_fresh(const char *source_path, int format) {
+	std::string baked_path = baked_mesh_path(source_path);
+
+	VfsFile file;
+	if (!vfs_open(baked_path.c_str(), &file)) {
+		return false;
+	}
+
+	const MeshHeader *header = mesh_header(&file);
+	bool fresh = header && header->format == (uint32_t)format && !mesh_is_stale(header, source_path);
+	vfs_close(&file);
+
+	return fresh;
+}
+
+/* imports source_path and writes its .mesh, the source's size and time mark the bake as fresh */
+bool bake_mesh(const char *source_path, int format) {
+	uint64_t size;
+	int64_t mtime;
+	if (!file_info(source_path, &size, &mtime)) {
+		LOG(LOG_ERROR, "Mesh source not found", log_str("path", source_path));
+		return false;
+	}
+
+	MeshData mesh;
+	if (!import_mesh(source_path, &mesh)) {
+		return false;
+	}
+
+	VertexCacheStats before = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+	optimize_mesh(&mesh);
+	VertexCacheStats after = analyze_vertex_cache(mesh.indices.data(), mesh.indices.size(), mesh.vertices.size());
+
+	LOG(LOG_INFO, "Optimized mesh", log_str("path", source_path), log_float("acmr_before", before.acmr), log_float("acmr_after", after.acmr),
+		log_float("atvr_before", before.atvr), log_float("atvr_after", after.atvr));
+
+	generate_lods(&mesh);
+	for (int i = 0; i < mesh.lod_count; ++i) {
+		LOG(LOG_INFO, "Mesh lod", log_str("path", source_path), log_int("lod", i), log_int("triangles", mesh.lods[i].index_count / 3), log_float("error", mesh.lods[i].error));
+	}
+
+	EncodedMesh encoded;
+	encode_mesh(&mesh, format, &encoded);
+
+	std::string baked_path = baked_mesh_path(source_path);
+	if (!write_mesh(baked_path.c_str(), &encoded, size, mtime)) {
+		LOG(LOG_ERROR, "Failed to write mesh", log_str("path", baked_path.c_str()));
+		return false;
+	}
+
+	LOG(LOG_INFO, "Baked mesh", log_str("path", baked_path.c_str()), log_str("format", mesh_format_names[format]),
+		log_int("vertices", encoded.vertex_count), log_int("indices", encoded.index_count), log_int("bytes", encoded.data.size()));
+	return true;
+}
+
+/* the size every layer of source's array is baked at, 0 by 0 (the source's own) outside an array */
+bool texture_bake_size(const std::vector<TextureBakeSource> &textures, const TextureBakeSource *source, int *width, int *height) {
+	*width = 0;
+	*height = 0;
+	if (!source->array) {
+		return true;
+	}
+
+	for (const TextureBakeSource &layer : textures) {
+		int w, h;
+		if (!layer.array || strcmp(layer.array, source->array)) {
+			continue;
+		}
+		if (!image_size(layer.path, &w, &h)) {
+			LOG(LOG_ERROR, "Texture source not found", log_str("path", layer.path));
+			return false;
+		}
+		*width = std::max(*width, w);
+		*height = std::max(*height, h);
+	}
+
+	return true;
+}
+
+/* width and height as from texture_bake_size */
+bool texture_bake_is_fresh(const TextureBakeSource *source, int width, int height) {
+	std::string baked_path = baked_texture_path(source->path);
+
+	VfsFile file;
+	if (!vfs_open(baked_path.c_str(), &file)) {
+		return false;
+	}
+
+	const TextureHeader *header = texture_header(&file);
+	bool fresh = header && !texture_is_stale(header, source->path) &&
+		(source->format == TEXTURE_FORMAT_AUTO || header->format == (uint32_t)source->format) &&
+		(width == 0 || (header->width == (uint32_t)width && header->height == (uint32_t)height));
+	vfs_close(&file);
+
+	return fresh;
+}
+
+bool image_is_opaque(const Image *image) {
+	for (size_t i = 3; i < image_bytes(image); i += 4) {
+		if (image->pixels[i] != 255) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* decodes the source, scales it to width by height unless those are 0, builds its mip chain and writes its .tex */
+bool bake_texture(const TextureBakeSource *source, int width, int height) {
+	uint64_t size;
+	int64_t mtime;
+	if (!file_info(source->path, &size, &mtime)) {
+		LOG(LOG_ERROR, "Texture source not found", log_str("path", source->path));
+		return false;
+	}
+
+	Image image;
+	if (!decode_image(source->path, &image)) {
+		return false;
+	}
+
+	if (width && (image.width != width || image.height != height)) {
+		LOG(LOG_INFO, "Scaling texture to its array", log_str("path", source->path), log_str("array", source->array),
+			log_int("width", image.width), log_int("height", image.height), log_int("array_width", width), log_int("array_height", height));
+		scale_image(&image, width, height);
+	}
+
+	int format = source->format;
+	if (format == TEXTURE_FORMAT_AUTO) {
+		format = image_is_opaque(&image) ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3;
+	}
+
+	EncodedTexture encoded;
+	encode_texture(image.pixels, image.width, image.height, format, &encoded);
+	float error = texture_error(&encoded, image.pixels);
+	size_t uncompressed = texture_storage_bytes(image.width, image.height, 1, 4, encoded.level_count);
+	free_image(&image);
+
+	std::string baked_path = baked_texture_path(source->path);
+	if (!write_texture(baked_path.c_str(), &encoded, size, mtime)) {
+		LOG(LOG_ERROR, "Failed to write texture", log_str("path", baked_path.c_str()));
+		return false;
+	}
+
+	LOG(LOG_INFO, "Baked texture", log_str("path", baked_path.c_str()), log_str("format", texture_format_names[format]),
+		log_int("width", encoded.width), log_int("height", encoded.height), log_int("levels", encoded.level_count),
+		log_int("bytes", encoded.data.size()), log_int("rgba8_bytes", uncompressed), log_float("rmse", error));
+	return true;
+}
+
+/* the native OBJ loader must produce what Assimp does */
+bool compare_importers(const char *source_path) {
+	MeshData native, assimp;
+	if (!load_obj(source_path, &native) || !import_mesh_assimp(source_path, &assimp)) {
+		return false;
+	}
+
+	if (native.vertices.size() != assimp.vertices.size() || native.indices != assimp.indices) {
+		LOG(LOG_ERROR, "Importers disagree on topology", log_str("path", source_path),
+			log_int("native_vertices", native.vertices.size()), log_int("assimp_vertices", assimp.vertices.size()),
+			log_int("native_indices", native.indices.size()), log_int("assimp_indices", assimp.indices.size()));
+		return false;
+	}
+
+	float pos_error = 0.0f, uv_error = 0.0f, normal_error = 0.0f;
+	for (size_t i = 0; i < native.vertices.size(); ++i) {
+		const MeshVertex &a = native.vertices[i], &b = assimp.vertices[i];
+		pos_error = std::max(pos_error, glm::length(a.pos - b.pos));
+		uv_error = std::max(uv_error, glm::length(a.uv - b.uv));
+		normal_error = std::max(normal_error, glm::length(a.normal - b.normal));
+	}
+
+	bool match = pos_error < 1e-5f && uv_error < 1e-5f && normal_error < 1e-3f;
+	LOG(match ? LOG_INFO : LOG_ERROR, match ? "Importers agree" : "Importers disagree on vertices", log_str("path", source_path),
+		log_float("pos_error", pos_error), log_float("uv_error", uv_error), log_float("normal_error", normal_error));
+	return match;
+}
+
+int main(int argc, char **argv) {
+	bool force = false;
+	bool compare = false;
+	int format = MESH_FORMAT_QUANTIZED;
+	int texture_format = TEXTURE_FORMAT_AUTO;
+	const char *pack_path = 0;
+	std::vector<BakeSource> sources;
+	std::vector<TextureBakeSource> textures;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--force")) {
+			force = true;
+		} else if (!strcmp(argv[i], "--compare")) {
+			compare = true;
+		} else if (!strcmp(argv[i], "--format") && i + 1 < argc && !strcmp(argv[i + 1], "float")) {
+			format = MESH_FORMAT_FLOAT;
+			++i;
+		} else if (!strcmp(argv[i], "--format") && i + 1 < argc && !strcmp(argv[i + 1], "quantized")) {
+			format = MESH_FORMAT_QUANTIZED;
+			++i;
+		} else if (!strcmp(argv[i], "--texture-format") && i + 1 < argc && !strcmp(argv[i + 1], "rgba8")) {
+			texture_format = TEXTURE_FORMAT_RGBA8;
+			++i;
+		} else if (!strcmp(argv[i], "--texture-format") && i + 1 < argc && !strcmp(argv[i + 1], "bc1")) {
+			texture_format = TEXTURE_FORMAT_BC1;
+			++i;
+		} else if (!strcmp(argv[i], "--texture-format") && i + 1 < argc && !strcmp(argv[i + 1], "bc3")) {
+			texture_format = TEXTURE_FORMAT_BC3;
+			++i;
+		} else if (!strcmp(argv[i], "--pack") && i + 1 < argc) {
+			pack_path = argv[++i];
+		} else if (argv[i][0] == '-') {
+			std::cout << "usage: " << argv[0] << " [--force] [--compare] [--format float|quantized] [--texture-format rgba8|bc1|bc3] [--pack out.pak] [model or image...]\n";
+			return EXIT_FAILURE;
+		} else if (has_extension(argv[i], ".png")) {
+			textures.push_back({ argv[i], texture_format, 0 });
+		} else {
+			sources.push_back({ argv[i], format });
+		}
+	}
+
+	/* --format and --texture-format apply to everything named, wherever they appear */
+	for (BakeSource &source : sources) {
+		source.format = format;
+	}
+	for (TextureBakeSource &texture : textures) {
+		texture.format = texture_format;
+	}
+
+	if (sources.empty() && textures.empty()) {
+		sources.assign(std::begin(default_sources), std::end(default_sources));
+		if (!compare) {
+			textures.assign(std::begin(default_textures), std::end(default_textures));
+		}
+	}
+
+	int failed = 0;
+	for (const BakeSource &source : sources) {
+		if (compare) {
+			if (!compare_importers(source.path)) {
+				++failed;
+			}
+			continue;
+		}
+
+		if (!force && mesh_bake_is_fresh(source.path, source.format)) {
+			LOG(LOG_INFO, "Mesh is up to date", log_str("path", source.path));
+			continue;
+		}
+
+		if (!bake_mesh(source.path, source.format)) {
+			++failed;
+		}
+	}
+
+	for (const TextureBakeSource &texture : textures) {
+		int width, height;
+		if (!texture_bake_size(textures, &texture, &width, &height)) {
+			++failed;
+			continue;
+		}
+
+		if (!force && texture_bake_is_fresh(&texture, width, height)) {
+			LOG(LOG_INFO, "Texture is up to date", log_str("path", texture.path));
+			continue;
+		}
+
+		if (!bake_texture(&texture, width, height)) {
+			++failed;
+		}
+	}
+
+	/* everything under resources, the bakes just written included, except what only the editor opens */
+	if (pack_path && !compare) {
+		std::vector<std::string> files, paths;
+		list_files("resources", &files);
+		for (const std::string &path : files) {
+			if (!has_extension(path.c_str(), ".blend") && !has_extension(path.c_str(), ".blend1")) {
+				paths.push_back(path);
+			}
+		}
+
+		if (!write_pack(pack_path, paths)) {
+			LOG(LOG_ERROR, "Failed to write pack", log_str("path", pack_path));
+			++failed;
+		}
+	}
+
+	log_flush();
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,265 @@
+/*
+ * Rendering benchmark. Runs named scenarios for a fixed number of frames with
+ * a scripted input path and writes frame time percentiles, draw calls and
+ * per pass timings to JSON.
+ *
+ *   Benchmark [--window] [--frames n] [--out results.json] [scenario...]
+ */
+#include <random>
+#include <algorithm>
+
+#define PLATFORMER_NO_MAIN
+#include "main.cpp"
+#include "worldgen.cpp"
+
+#define BENCHMARK_WARMUP_FRAMES 30
+
+struct InputStep {
+	int first_frame;
+	int last_frame;
+	int key;
+};
+
+struct Scenario {
+	const char *name;
+	void (*setup)(Platformer *platformer);
+	const InputStep *script;
+	int script_length;
+};
+
+/* a loop around the level: right, down, left, up */
+const InputStep walk_loop[] = {
+	{ 0, 89, GLFW_KEY_D },
+	{ 90, 149, GLFW_KEY_S },
+	{ 150, 239, GLFW_KEY_A },
+	{ 240, 299, GLFW_KEY_W },
+};
+
+const InputStep walk_right[] = {
+	{ 0, 299, GLFW_KEY_D },
+};
+
+void setup_world1(Platformer *platformer) {
+	load_world(platformer, "resources/worlds/world1.txt");
+}
+
+void setup_large(Platformer *platformer) {
+	generate_world(platformer, 96, 48, 0.1f, 1);
+}
+
+void setup_crates(Platformer *platformer) {
+	generate_falling_crates(platformer, 24, 400, 2);
+}
+
+void setup_water(Platformer *platformer) {
+	generate_island(platformer, 3);
+}
+
+const Scenario scenarios[] = {
+	{ "world1", setup_world1, walk_loop, 4 },
+	{ "large", setup_large, walk_right, 1 },
+	{ "crates", setup_crates, 0, 0 },
+	{ "water", setup_water, 0, 0 },
+};
+
+struct Samples {
+	std::vector<double> values;
+
+	void add(double value) {
+		values.push_back(value);
+	}
+
+	double mean() const {
+		double sum = 0.0;
+		for (double value : values) sum += value;
+		return values.empty() ? 0.0 : sum / values.size();
+	}
+
+	/* nearest rank */
+	double percentile(double p) const {
+		if (values.empty()) {
+			return 0.0;
+		}
+
+		std::vector<double> sorted = values;
+		std::sort(sorted.begin(), sorted.end());
+		size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+		return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+	}
+
+	void write_json(FILE *out) const {
+		fprintf(out, "{ \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f }",
+			mean(), percentile(50), percentile(95), percentile(99), percentile(100));
+	}
+};
+
+struct ScenarioResult {
+	const char *name;
+	int frames;
+	Samples frame_ms;
+	Samples draw_calls;
+	Samples triangles;
+	Samples state_changes;
+	Samples skipped_state_changes;
+	Samples pass_cpu_ms[FRAME_PASS_COUNT];
+	Samples pass_gpu_ms[FRAME_PASS_COUNT];
+};
+
+void apply_script(const Scenario *scenario, int frame) {
+	memset(keys_down, 0, sizeof(keys_down));
+
+	for (int i = 0; i < scenario->script_length; ++i) {
+		const InputStep *step = &scenario->script[i];
+		if (frame >= step->first_frame && frame <= step->last_frame) {
+			keys_down[step->key] = true;
+		}
+	}
+}
+
+void run_scenario(Platformer *platformer, const Scenario *scenario, int frames, ScenarioResult *result) {
+	Platform *platform = platformer->platform;
+
+	scenario->setup(platformer);
+	platformer->camera.x = platformer->player.x;
+	platformer->camera.z = platformer->player.z / 2;
+
+	result->name = scenario->name;
+	result->frames = frames;
+
+	for (int frame = -BENCHMARK_WARMUP_FRAMES; frame < frames; ++frame) {
+		apply_script(scenario, std::max(frame, 0));
+
+		double start = platform_clock();
+		update(platformer);
+		render(platformer);
+		platform_swap(platform);
+
+		/* wait for the GPU so the frame time covers the whole frame */
+		glFinish();
+		double frame_ms = (platform_clock() - start) * 1000.0;
+
+		if (frame < 0) {
+			continue;
+		}
+
+		result->frame_ms.add(frame_ms);
+		result->draw_calls.add(last_frame_render_stats.draw_calls);
+		result->triangles.add(last_frame_render_stats.triangles);
+		result->state_changes.add(gl_state.last_frame.total_issued());
+		result->skipped_state_changes.add(gl_state.last_frame.total_skipped());
+		for (int pass = 0; pass < FRAME_PASS_COUNT; ++pass) {
+			result->pass_cpu_ms[pass].add(platformer->pass_cpu_ms[pass]);
+			result->pass_gpu_ms[pass].add(platformer->gpu_timers.pass_ms[pass]);
+		}
+	}
+
+	memset(keys_down, 0, sizeof(keys_down));
+}
+
+void write_pass_samples(FILE *out, Samples *passes) {
+	fprintf(out, "{\n");
+	for (int pass = 0; pass < FRAME_PASS_COUNT; ++pass) {
+		fprintf(out, "\t\t\t\t\"%s\": ", frame_pass_names[pass]);
+		passes[pass].write_json(out);
+		fprintf(out, pass + 1 < FRAME_PASS_COUNT ? ",\n" : "\n");
+	}
+	fprintf(out, "\t\t\t}");
+}
+
+void write_results(FILE *out, std::vector<ScenarioResult> &results) {
+	fprintf(out, "{\n\t\"scenarios\": [\n");
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		ScenarioResult *result = &results[i];
+
+		fprintf(out, "\t\t{\n");
+		fprintf(out, "\t\t\t\"name\": \"%s\",\n", result->name);
+		fprintf(out, "\t\t\t\"frames\": %d,\n", result->frames);
+		fprintf(out, "\t\t\t\"frame_ms\": ");
+		result->frame_ms.write_json(out);
+		fprintf(out, ",\n\t\t\t\"draw_calls\": ");
+		result->draw_calls.write_json(out);
+		fprintf(out, ",\n\t\t\t\"triangles\": ");
+		result->triangles.write_json(out);
+		fprintf(out, ",\n\t\t\t\"state_changes\": ");
+		result->state_changes.write_json(out);
+		fprintf(out, ",\n\t\t\t\"skipped_state_changes\": ");
+		result->skipped_state_changes.write_json(out);
+		fprintf(out, ",\n\t\t\t\"pass_cpu_ms\": ");
+		write_pass_samples(out, result->pass_cpu_ms);
+		fprintf(out, ",\n\t\t\t\"pass_gpu_ms\": ");
+		write_pass_samples(out, result->pass_gpu_ms);
+		fprintf(out, "\n");
+		fprintf(out, i + 1 < results.size() ? "\t\t},\n" : "\t\t}\n");
+	}
+
+	fprintf(out, "\t]\n}\n");
+}
+
+int main(int argc, char **argv) {
+	bool headless = true;
+	int frames = 600;
+	const char *out_path = "benchmark.json";
+	std::vector<const Scenario *> selected;
+
+	int scenario_count = sizeof(scenarios) / sizeof(scenarios[0]);
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--window")) {
+			headless = false;
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+			out_path = argv[++i];
+		} else {
+			const Scenario *found = 0;
+			for (int s = 0; s < scenario_count; ++s) {
+				if (!strcmp(argv[i], scenarios[s].name)) {
+					found = &scenarios[s];
+				}
+			}
+
+			if (!found) {
+				std::cout << "Unknown scenario '" << argv[i] << "'\n";
+				return EXIT_FAILURE;
+			}
+			selected.push_back(found);
+		}
+	}
+
+	if (selected.empty()) {
+		for (int s = 0; s < scenario_count; ++s) {
+			selected.push_back(&scenarios[s]);
+		}
+	}
+
+	Platform *platform = create_platform(1280, 720, headless);
+	platform->fixed_timestep = true;
+
+	Platformer platformer;
+	global_platformer = &platformer;
+
+	init(&platformer, platform);
+	asset_loader_finish(&platformer.assets);
+	platformer.scaler.enabled = false;
+
+	std::vector<ScenarioResult> results(selected.size());
+	for (size_t i = 0; i < selected.size(); ++i) {
+		std::cout << "Running " << selected[i]->name << "...\n";
+		run_scenario(&platformer, selected[i], frames, &results[i]);
+		std::cout << "  p50 " << results[i].frame_ms.percentile(50) << " ms, p99 " << results[i].frame_ms.percentile(99) << " ms\n";
+	}
+
+	FILE *out = fopen(out_path, "w");
+	if (!out) {
+		die("Failed to open benchmark output!");
+	}
+	write_results(out, results);
+	fclose(out);
+
+	destroy(&platformer);
+	destroy_platform(platform);
+	memory_leak_report();
+
+	return 0;
+}
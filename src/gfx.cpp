@@ -1,12 +1,34 @@
+/* source with defines inserted right after its #version line, which has to stay first */
+std::string shader_with_defines(const std::string &source, const char *defines) {
+	if (!defines || !*defines) {
+		return source;
+	}
+
+	size_t line_end = source.compare(0, 8, "#version") == 0 ? source.find('\n') : std::string::npos;
+	if (line_end == std::string::npos) {
+		return defines + source;
+	}
+
+	return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
+
 struct Shader {
 	std::unordered_map<const char *, GLint> uniform_location_cache;
 	GLuint program;
 
 	Shader(const char *vert_path, const char *frag_path) {
-		GLint linked;
-		auto vert_shader_src = read_file(vert_path);
-		auto frag_shader_src = read_file(frag_path);
+		compile(read_file(vert_path), read_file(frag_path), vert_path, frag_path);
+	}
 
+	/* from sources already read, the paths only label the program */
+	Shader(const std::string &vert_src, const std::string &frag_src, const char *vert_path, const char *frag_path) {
+		compile(vert_src, frag_src, vert_path, frag_path);
+	}
+
+	void compile(const std::string &vert_shader_src, const std::string &frag_shader_src, const char *vert_path, const char *frag_path) {
+		PROFILE_ZONE("compile shader");
+
+		GLint linked;
 		auto vert_shader = load_shader(vert_shader_src.c_str(), GL_VERTEX_SHADER, "Vertex Shader");
 		auto frag_shader = load_shader(frag_shader_src.c_str(), GL_FRAGMENT_SHADER, "Fragment Shader");
 
@@ -16,15 +38,24 @@ struct Shader {
 
 		glLinkProgram(program);
 		checkOpenGLError();
+		gl_label(GL_PROGRAM, program, vert_path);
 		glGetProgramiv(program, GL_LINK_STATUS, &linked);
 		if (linked != 1) {
-			std::cout << "Linking failed\n";
+			LOG(LOG_ERROR, "Linking failed", log_str("vertex", vert_path), log_str("fragment", frag_path));
 			print_program_log(program);
 		}
+
+		/* the program keeps what it needs, the shader objects go with it */
+		glDeleteShader(vert_shader);
+		glDeleteShader(frag_shader);
+	}
+
+	~Shader() {
+		gl_delete_program(program);
 	}
 
 	void use() {
-		glUseProgram(program);
+		gl_use_program(program);
 	}
 
 	void load_int(const char *name, int value) {
@@ -72,7 +103,7 @@ struct Shader {
 		checkOpenGLError();
 		glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
 		if (compiled != 1) {
-			std::cout << type_name << " Compilation failed\n";
+			LOG(LOG_ERROR, "Compilation failed", log_str("stage", type_name));
 			print_shader_log(shader);
 		}
 
@@ -99,7 +130,7 @@ struct Shader {
 
 		log = new char[len];
 		glGetShaderInfoLog(shader, len, &chWrittn, log);
-		std::cout << "Shader Info Log: " << log << "\n";
+		LOG(LOG_ERROR, "Shader info log", log_str("log", log));
 		delete[] log;
 	}
 
@@ -113,7 +144,7 @@ struct Shader {
 
 		log = new char[len];
 		glGetProgramInfoLog(prog, len, &chWrittn, log);
-		std::cout << "Program Info Log: " << log << "\n";
+		LOG(LOG_ERROR, "Program info log", log_str("log", log));
 		delete[] log;
 	}
 };
@@ -141,50 +172,292 @@ struct PositionalLight {
 
 typedef GLuint Texture;
 
-Texture load_texture(const char *path) {
-	Texture id;
-	int w, h;
+/* decoded RGBA8 pixels, layers back to back, from mem_alloc(MEM_TEXTURE) */
+struct Image {
+	int width;
+	int height;
+	int layers;
+	unsigned char *pixels;
+};
+
+size_t image_bytes(const Image *image) {
+	return (size_t)image->width * image->height * image->layers * 4;
+}
+
+void free_image(Image *image) {
+	mem_free(image->pixels);
+	image->pixels = 0;
+}
+
+/* safe on any thread, no GL; path only names the image in errors */
+bool decode_image_file(const char *path, const VfsFile *file, Image *image) {
+	PROFILE_ZONE("decode_image");
 
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *image = stbi_load(path, &w, &h, 0, STBI_rgb_alpha);
+	image->pixels = 0;
+	image->layers = 1;
 
-	if (!image) {
-		std::cout << "Failed to load texture '" << path << "'!\n";
-		std::exit(EXIT_FAILURE);
+	if (file->data) {
+		stbi_set_flip_vertically_on_load_thread(true);
+		image->pixels = stbi_load_from_memory(file->data, file->size, &image->width, &image->height, 0, STBI_rgb_alpha);
 	}
 
-	glGenTextures(1, &id);
-	glBindTexture(GL_TEXTURE_2D, id);
+	if (!image->pixels) {
+		LOG(LOG_ERROR, "Failed to load texture", log_str("path", path));
+		return false;
+	}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return true;
+}
+
+bool decode_image(const char *path, Image *image) {
+	VfsFile file;
+	vfs_open(path, &file);
+	bool ok = decode_image_file(path, &file, image);
+	vfs_close(&file);
+	return ok;
+}
+
+/* the size of the image at path without decoding its pixels */
+bool image_size(const char *path, int *width, int *height) {
+	VfsFile file;
+	int components;
+	bool ok = vfs_open(path, &file) && stbi_info_from_memory(file.data, file.size, width, height, &components);
+	vfs_close(&file);
+	return ok;
+}
+
+/* nearest neighbour, one layer; scales the layers of an array to its size */
+void scale_image(Image *image, int width, int height) {
+	unsigned char *pixels = (unsigned char *)mem_alloc(MEM_TEXTURE, (size_t)width * height * 4);
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			int sx = x * image->width / width;
+			int sy = y * image->height / height;
+			memcpy(&pixels[(y * width + x) * 4], &image->pixels[(sy * image->width + sx) * 4], 4);
+		}
+	}
+
+	free_image(image);
+	image->pixels = pixels;
+	image->width = width;
+	image->height = height;
+}
+
+/*
+ * Decodes several images as the layers of one array, the layer index of
+ * paths[i] is i. The array takes the size of the largest image; Bake scales
+ * the others to it, so a smaller layer is only scaled here, with a warning,
+ * when the array loads from its sources. files holds the images already
+ * read, in the order of paths, or is null to read them.
+ */
+bool decode_image_array(const char **paths, int count, const VfsFile *files, Image *image) {
+	std::vector<Image> layers(count);
+	int w = 0, h = 0;
+	bool ok = true;
+
+	for (int i = 0; i < count; ++i) {
+		ok = ok && (files ? decode_image_file(paths[i], &files[i], &layers[i]) : decode_image(paths[i], &layers[i]));
+		if (ok) {
+			w = std::max(w, layers[i].width);
+			h = std::max(h, layers[i].height);
+		}
+	}
+
+	if (ok) {
+		for (int i = 0; i < count; ++i) {
+			if (layers[i].width != w || layers[i].height != h) {
+				LOG(LOG_WARNING, "Scaling texture array layer, run Bake", log_str("path", paths[i]), log_int("width", layers[i].width), log_int("height", layers[i].height),
+					log_int("array_width", w), log_int("array_height", h));
+				scale_image(&layers[i], w, h);
+			}
+		}
+
+		image->width = w;
+		image->height = h;
+		image->layers = count;
+		image->pixels = (unsigned char *)mem_alloc(MEM_TEXTURE, image_bytes(image));
+
+		for (int i = 0; i < count; ++i) {
+			memcpy(image->pixels + (size_t)w * h * 4 * i, layers[i].pixels, (size_t)w * h * 4);
+		}
+	}
+
+	for (Image &layer : layers) {
+		free_image(&layer);
+	}
+
+	return ok;
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
-	glGenerateMipmap(GL_TEXTURE_2D);
+/* repeat, trilinear and the most anisotropy the driver offers */
+void set_texture_parameters(GLenum target) {
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	if (glewIsSupported("GL_EXT_texture_filter_anisotropic")) {
 		GLfloat anisoSetting = 0.0f;
 		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &anisoSetting);
-		glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisoSetting);
+		glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, anisoSetting);
+	}
+}
+
+/*
+ * Creates a mipmapped GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY from image.
+ * pixels is what glTexSubImage reads: the image's own pixels, or an offset
+ * into the bound GL_PIXEL_UNPACK_BUFFER.
+ */
+Texture create_texture(const Image *image, GLenum target, const void *pixels, const char *label) {
+	Texture id;
+	int w = image->width, h = image->height;
+	int levels = mip_levels(w, h);
+
+	glGenTextures(1, &id);
+	gl_bind_texture(target, id);
+
+	if (target == GL_TEXTURE_2D_ARRAY) {
+		glTexStorage3D(target, levels, GL_RGBA8, w, h, image->layers);
+		glTexSubImage3D(target, 0, 0, 0, 0, w, h, image->layers, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	} else {
+		glTexStorage2D(target, levels, GL_RGBA8, w, h);
+		glTexSubImage2D(target, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+
+	set_texture_parameters(target);
+	glGenerateMipmap(target);
+
+	gpu_memory_track(GPU_MEM_TEXTURE, id, texture_storage_bytes(w, h, image->layers, 4, levels), label);
+	gl_label(GL_TEXTURE, id, label);
+
+	gl_bind_texture(target, 0);
+
+	return id;
+}
+
+GLenum texture_internal_format(int format) {
+	switch (format) {
+	case TEXTURE_FORMAT_BC1:
+		return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case TEXTURE_FORMAT_BC3:
+		return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	default:
+		return GL_RGBA8;
+	}
+}
+
+/*
+ * Creates a texture from baked levels, one bake per layer. layers[i] is
+ * where the levels of layer i start: mapped memory, or an offset into the
+ * bound GL_PIXEL_UNPACK_BUFFER. Every level is uploaded as baked.
+ */
+Texture create_baked_texture(const TextureHeader *header, GLenum target, const unsigned char *const *layers, int layer_count, const char *label) {
+	Texture id;
+	GLenum internal_format = texture_internal_format(header->format);
+	bool compressed = texture_format_compressed(header->format);
+	int w = header->width, h = header->height;
+
+	glGenTextures(1, &id);
+	gl_bind_texture(target, id);
+
+	if (target == GL_TEXTURE_2D_ARRAY) {
+		glTexStorage3D(target, header->level_count, internal_format, w, h, layer_count);
+	} else {
+		glTexStorage2D(target, header->level_count, internal_format, w, h);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	for (uint32_t level = 0; level < header->level_count; ++level) {
+		int level_w = std::max(w >> level, 1), level_h = std::max(h >> level, 1);
+		const TextureLevel *entry = &header->levels[level];
+
+		for (int layer = 0; layer < layer_count; ++layer) {
+			const unsigned char *pixels = layers[layer] + entry->offset;
+
+			if (target == GL_TEXTURE_2D_ARRAY && compressed) {
+				glCompressedTexSubImage3D(target, level, 0, 0, layer, level_w, level_h, 1, internal_format, entry->size, pixels);
+			} else if (target == GL_TEXTURE_2D_ARRAY) {
+				glTexSubImage3D(target, level, 0, 0, layer, level_w, level_h, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			} else if (compressed) {
+				glCompressedTexSubImage2D(target, level, 0, 0, level_w, level_h, internal_format, entry->size, pixels);
+			} else {
+				glTexSubImage2D(target, level, 0, 0, level_w, level_h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			}
+		}
+	}
+
+	set_texture_parameters(target);
+
+	gpu_memory_track(GPU_MEM_TEXTURE, id, (size_t)header->data_size * layer_count, label);
+	gl_label(GL_TEXTURE, id, label);
 
-	stbi_image_free(image);
+	gl_bind_texture(target, 0);
 
 	return id;
 }
 
+Texture load_texture(const char *path) {
+	PROFILE_ZONE("load_texture");
+
+	BakedTexture baked;
+	if (open_baked_texture(path, nullptr, &baked)) {
+		Texture id = create_baked_texture(baked.header, GL_TEXTURE_2D, &baked.data, 1, path);
+		close_baked_texture(&baked);
+		return id;
+	}
+
+	Image image;
+	if (!decode_image(path, &image)) {
+		die("Failed to load texture!");
+	}
+
+	Texture id = create_texture(&image, GL_TEXTURE_2D, image.pixels, path);
+	free_image(&image);
+
+	return id;
+}
+
+Texture load_texture_array(const char **paths, int count) {
+	PROFILE_ZONE("load_texture_array");
+
+	std::vector<BakedTexture> baked(count);
+	if (open_baked_textures(paths, count, nullptr, baked.data())) {
+		std::vector<const unsigned char *> layers;
+		for (BakedTexture &layer : baked) {
+			layers.push_back(layer.data);
+		}
+
+		Texture id = create_baked_texture(baked[0].header, GL_TEXTURE_2D_ARRAY, layers.data(), count, paths[0]);
+		for (BakedTexture &layer : baked) {
+			close_baked_texture(&layer);
+		}
+		return id;
+	}
+
+	Image image;
+	if (!decode_image_array(paths, count, nullptr, &image)) {
+		die("Failed to load texture!");
+	}
+
+	Texture id = create_texture(&image, GL_TEXTURE_2D_ARRAY, image.pixels, paths[0]);
+	free_image(&image);
+
+	return id;
+}
+
+void delete_texture(Texture id) {
+	gpu_memory_release(GPU_MEM_TEXTURE, id);
+	gl_delete_texture(id);
+}
+
 void bind_texture(Texture id) {
-	glBindTexture(GL_TEXTURE_2D, id);
+	gl_bind_texture(GL_TEXTURE_2D, id);
 }
 
 GLuint create_frame_buffer() {
 	GLuint fb;
 	glGenFramebuffers(1, &fb);
-	glBindFramebuffer(GL_FRAMEBUFFER, fb);
+	gl_bind_framebuffer(fb);
 	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 	return fb;
 }
@@ -193,11 +466,122 @@ GLuint create_texture_attachment(int width, int height) {
 	GLuint texture;
 	glGenTextures(1, &texture);
 
-	glBindTexture(GL_TEXTURE_2D, texture);
+	gl_bind_texture(GL_TEXTURE_2D, texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	gpu_memory_track(GPU_MEM_TEXTURE, texture, texture_storage_bytes(width, height, 1, 3, 1), "attachment");
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
 
 	return texture;
 }
+
+/* re-specifies the storage in place, the frame buffer attachment stays valid */
+void resize_texture_attachment(GLuint texture, int width, int height) {
+	gl_bind_texture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, 0);
+	gl_bind_texture(GL_TEXTURE_2D, 0);
+	gpu_memory_track(GPU_MEM_TEXTURE, texture, texture_storage_bytes(width, height, 1, 3, 1), "attachment");
+}
+
+/*
+ * Multisampled color + depth target the scene is drawn into. Its size is
+ * independent of the window; present_render_target resolves it and scales it
+ * to whatever frame buffer it is presented to.
+ */
+struct RenderTarget {
+	GLuint frame_buffer;
+	GLuint color_buffer;
+	GLuint depth_buffer;
+
+	GLuint resolve_frame_buffer;
+	GLuint resolve_buffer;
+
+	int width;
+	int height;
+	int samples;
+};
+
+void allocate_render_target(RenderTarget *target) {
+	glBindRenderbuffer(GL_RENDERBUFFER, target->color_buffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target->samples, GL_RGBA8, target->width, target->height);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, target->depth_buffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, target->samples, GL_DEPTH_COMPONENT24, target->width, target->height);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, target->resolve_buffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, target->width, target->height);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	size_t pixels = (size_t)target->width * target->height;
+	gpu_memory_track(GPU_MEM_RENDER_TARGET, target->color_buffer, pixels * target->samples * 4, "scene color");
+	gpu_memory_track(GPU_MEM_RENDER_TARGET, target->depth_buffer, pixels * target->samples * 4, "scene depth");
+	gpu_memory_track(GPU_MEM_RENDER_TARGET, target->resolve_buffer, pixels * 4, "scene resolve");
+}
+
+RenderTarget create_render_target(int width, int height, int samples) {
+	RenderTarget target;
+	target.width = width;
+	target.height = height;
+	target.samples = samples;
+
+	glGenRenderbuffers(1, &target.color_buffer);
+	glGenRenderbuffers(1, &target.depth_buffer);
+	glGenRenderbuffers(1, &target.resolve_buffer);
+	allocate_render_target(&target);
+
+	target.frame_buffer = create_frame_buffer();
+	gl_label(GL_FRAMEBUFFER, target.frame_buffer, "scene");
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color_buffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth_buffer);
+
+	target.resolve_frame_buffer = create_frame_buffer();
+	gl_label(GL_FRAMEBUFFER, target.resolve_frame_buffer, "scene resolve");
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.resolve_buffer);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		die("Render target is incomplete!");
+	}
+
+	return target;
+}
+
+void resize_render_target(RenderTarget *target, int width, int height) {
+	if (target->width == width && target->height == height) {
+		return;
+	}
+
+	target->width = width;
+	target->height = height;
+	allocate_render_target(target);
+}
+
+void destroy_render_target(RenderTarget *target) {
+	GLuint renderbuffers[] = { target->color_buffer, target->depth_buffer, target->resolve_buffer };
+	for (GLuint renderbuffer : renderbuffers) {
+		gpu_memory_release(GPU_MEM_RENDER_TARGET, renderbuffer);
+	}
+	glDeleteRenderbuffers(3, renderbuffers);
+
+	gl_delete_framebuffer(target->frame_buffer);
+	gl_delete_framebuffer(target->resolve_frame_buffer);
+}
+
+void present_render_target(RenderTarget *target, GLuint frame_buffer, int width, int height) {
+	int w = target->width;
+	int h = target->height;
+
+	if (w == width && h == height) {
+		gl_bind_framebuffers(target->frame_buffer, frame_buffer);
+		glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		return;
+	}
+
+	/* multisampled buffers can't be scaled by a blit, resolve first */
+	gl_bind_framebuffers(target->frame_buffer, target->resolve_frame_buffer);
+	glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+	gl_bind_framebuffers(target->resolve_frame_buffer, frame_buffer);
+	glBlitFramebuffer(0, 0, w, h, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+}
@@ -0,0 +1,122 @@
+/*
+ * GL validation through KHR_debug. With PLATFORMER_GL_DEBUG defined (Debug
+ * builds, or Release with premake's --gl-debug option) the context is created
+ * as a debug context, driver messages arrive through a callback and land in
+ * the log, GL objects carry labels and every frame pass is a debug group, so
+ * captures in RenderDoc or apitrace read like the code. Without it labels and
+ * groups compile to nothing and glGetError is never polled.
+ */
+#ifdef PLATFORMER_GL_DEBUG
+#define GL_DEBUG_GROUP(name) GLDebugGroup PROFILE_CONCAT(gl_debug_group_, __LINE__)(name)
+#else
+#define GL_DEBUG_GROUP(name)
+#endif
+
+#ifdef PLATFORMER_GL_DEBUG
+static bool gl_debug_output = false;
+
+const char *gl_debug_source_name(GLenum source) {
+	switch (source) {
+	case GL_DEBUG_SOURCE_API: return "api";
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window system";
+	case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+	case GL_DEBUG_SOURCE_THIRD_PARTY: return "third party";
+	case GL_DEBUG_SOURCE_APPLICATION: return "application";
+	default: return "other";
+	}
+}
+
+const char *gl_debug_type_name(GLenum type) {
+	switch (type) {
+	case GL_DEBUG_TYPE_ERROR: return "error";
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+	case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+	case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+	case GL_DEBUG_TYPE_MARKER: return "marker";
+	default: return "other";
+	}
+}
+
+void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei, const GLchar *message, const void *) {
+	int level = LOG_INFO;
+	if (type == GL_DEBUG_TYPE_ERROR || severity == GL_DEBUG_SEVERITY_HIGH) {
+		level = LOG_ERROR;
+	} else if (severity == GL_DEBUG_SEVERITY_MEDIUM) {
+		level = LOG_WARNING;
+	}
+
+	LOG(level, message, log_str("source", gl_debug_source_name(source)), log_str("type", gl_debug_type_name(type)), log_int("id", id));
+}
+
+struct GLDebugGroup {
+	GLDebugGroup(const char *name) {
+		if (gl_debug_output) {
+			glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+		}
+	}
+
+	~GLDebugGroup() {
+		if (gl_debug_output) {
+			glPopDebugGroup();
+		}
+	}
+};
+#endif
+
+/* call once the context is current and GLEW is loaded */
+void gl_debug_init() {
+#ifdef PLATFORMER_GL_DEBUG
+	GLint flags = 0;
+	glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+
+	if (!GLEW_KHR_debug || !(flags & GL_CONTEXT_FLAG_DEBUG_BIT)) {
+		LOG(LOG_WARNING, "No debug context, GL errors are polled instead");
+		return;
+	}
+
+	gl_enable(GL_DEBUG_OUTPUT);
+	/* messages arrive on the calling thread, inside the call that caused them */
+	gl_enable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(gl_debug_callback, 0);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, 0, GL_FALSE);
+	/* our own debug groups would echo back as messages */
+	glDebugMessageControl(GL_DEBUG_SOURCE_APPLICATION, GL_DONT_CARE, GL_DONT_CARE, 0, 0, GL_FALSE);
+
+	gl_debug_output = true;
+	LOG(LOG_INFO, "GL debug output enabled");
+#endif
+}
+
+/* identifier is GL_TEXTURE, GL_BUFFER, GL_PROGRAM, GL_FRAMEBUFFER, GL_VERTEX_ARRAY, ... */
+void gl_label(GLenum identifier, GLuint name, const char *label) {
+#ifdef PLATFORMER_GL_DEBUG
+	if (gl_debug_output) {
+		glObjectLabel(identifier, name, -1, label);
+	}
+#else
+	(void)identifier;
+	(void)name;
+	(void)label;
+#endif
+}
+
+/* falls back to polling in debug builds without a debug context, free in release */
+bool checkOpenGLError() {
+#ifdef PLATFORMER_GL_DEBUG
+	if (gl_debug_output) {
+		return false;
+	}
+
+	bool found_error = false;
+	int glErr = glGetError();
+	while (glErr != GL_NO_ERROR) {
+		LOG(LOG_ERROR, "glError", log_int("code", glErr));
+		found_error = true;
+		glErr = glGetError();
+	}
+	return found_error;
+#else
+	return false;
+#endif
+}
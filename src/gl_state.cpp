@@ -0,0 +1,201 @@
+/*
+ * Shadow copy of the GL state we touch every frame. All binds go through the
+ * gl_* wrappers below so calls that would not change anything are dropped
+ * before they reach the driver.
+ */
+#define GL_STATE_TEXTURE_UNITS 16
+#define GL_STATE_UNKNOWN 0xffffffff
+
+#define STATE_PROGRAM 0
+#define STATE_TEXTURE 1
+#define STATE_VAO 2
+#define STATE_FRAMEBUFFER 3
+#define STATE_VIEWPORT 4
+#define STATE_CAPABILITY 5
+#define STATE_COUNT 6
+
+struct GLStateCounters {
+	unsigned int issued[STATE_COUNT];
+	unsigned int skipped[STATE_COUNT];
+
+	unsigned int total_issued() const {
+		unsigned int total = 0;
+		for (int i = 0; i < STATE_COUNT; ++i) total += issued[i];
+		return total;
+	}
+
+	unsigned int total_skipped() const {
+		unsigned int total = 0;
+		for (int i = 0; i < STATE_COUNT; ++i) total += skipped[i];
+		return total;
+	}
+};
+
+struct GLState {
+	GLuint program;
+	GLuint vao;
+	GLuint framebuffer;
+	GLuint active_unit;
+	GLuint textures[GL_STATE_TEXTURE_UNITS][2]; /* GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY */
+	GLint viewport[4];
+	std::unordered_map<GLenum, bool> capabilities;
+
+	GLStateCounters counters;
+	GLStateCounters last_frame;
+};
+
+static GLState gl_state;
+
+void gl_state_invalidate() {
+	gl_state.program = GL_STATE_UNKNOWN;
+	gl_state.vao = GL_STATE_UNKNOWN;
+	gl_state.framebuffer = GL_STATE_UNKNOWN;
+	gl_state.active_unit = GL_STATE_UNKNOWN;
+
+	for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit) {
+		gl_state.textures[unit][0] = GL_STATE_UNKNOWN;
+		gl_state.textures[unit][1] = GL_STATE_UNKNOWN;
+	}
+
+	for (int i = 0; i < 4; ++i) {
+		gl_state.viewport[i] = -1;
+	}
+
+	gl_state.capabilities.clear();
+}
+
+void gl_state_end_frame() {
+	gl_state.last_frame = gl_state.counters;
+	gl_state.counters = {};
+}
+
+bool gl_state_changed(int kind, bool changed) {
+	if (changed) {
+		gl_state.counters.issued[kind]++;
+	} else {
+		gl_state.counters.skipped[kind]++;
+	}
+	return changed;
+}
+
+void gl_use_program(GLuint program) {
+	if (gl_state_changed(STATE_PROGRAM, gl_state.program != program)) {
+		glUseProgram(program);
+		gl_state.program = program;
+	}
+}
+
+void gl_delete_program(GLuint program) {
+	if (gl_state.program == program) {
+		gl_state.program = GL_STATE_UNKNOWN;
+	}
+	glDeleteProgram(program);
+}
+
+void gl_active_texture(GLuint unit) {
+	/* not counted, it only selects which unit the next bind goes to */
+	if (gl_state.active_unit != unit) {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		gl_state.active_unit = unit;
+	}
+}
+
+void gl_bind_texture(GLenum target, GLuint texture) {
+	GLuint unit = gl_state.active_unit;
+	if (unit >= GL_STATE_TEXTURE_UNITS) {
+		gl_active_texture(0);
+		unit = 0;
+	}
+
+	GLuint *bound = &gl_state.textures[unit][target == GL_TEXTURE_2D_ARRAY ? 1 : 0];
+	if (gl_state_changed(STATE_TEXTURE, *bound != texture)) {
+		glBindTexture(target, texture);
+		*bound = texture;
+	}
+}
+
+void gl_delete_texture(GLuint texture) {
+	for (int unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit) {
+		for (int target = 0; target < 2; ++target) {
+			if (gl_state.textures[unit][target] == texture) {
+				gl_state.textures[unit][target] = GL_STATE_UNKNOWN;
+			}
+		}
+	}
+	glDeleteTextures(1, &texture);
+}
+
+void gl_bind_vertex_array(GLuint vao) {
+	if (gl_state_changed(STATE_VAO, gl_state.vao != vao)) {
+		glBindVertexArray(vao);
+		gl_state.vao = vao;
+	}
+}
+
+/* the name may be handed out again, so it must not stay cached as bound */
+void gl_delete_vertex_array(GLuint vao) {
+	if (gl_state.vao == vao) {
+		gl_state.vao = GL_STATE_UNKNOWN;
+	}
+	glDeleteVertexArrays(1, &vao);
+}
+
+void gl_bind_framebuffer(GLuint framebuffer) {
+	if (gl_state_changed(STATE_FRAMEBUFFER, gl_state.framebuffer != framebuffer)) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		gl_state.framebuffer = framebuffer;
+	}
+}
+
+void gl_delete_framebuffer(GLuint framebuffer) {
+	if (gl_state.framebuffer == framebuffer) {
+		gl_state.framebuffer = GL_STATE_UNKNOWN;
+	}
+	glDeleteFramebuffers(1, &framebuffer);
+}
+
+/* separate read and draw bindings, used for blits */
+void gl_bind_framebuffers(GLuint read, GLuint draw) {
+	if (read == draw) {
+		gl_bind_framebuffer(read);
+		return;
+	}
+
+	gl_state_changed(STATE_FRAMEBUFFER, true);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw);
+	gl_state.framebuffer = GL_STATE_UNKNOWN;
+}
+
+void gl_viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+	GLint *v = gl_state.viewport;
+	if (gl_state_changed(STATE_VIEWPORT, v[0] != x || v[1] != y || v[2] != width || v[3] != height)) {
+		glViewport(x, y, width, height);
+		v[0] = x;
+		v[1] = y;
+		v[2] = width;
+		v[3] = height;
+	}
+}
+
+void gl_set_capability(GLenum capability, bool enabled) {
+	auto it = gl_state.capabilities.find(capability);
+	bool known = it != gl_state.capabilities.end();
+
+	if (gl_state_changed(STATE_CAPABILITY, !known || it->second != enabled)) {
+		if (enabled) {
+			glEnable(capability);
+		} else {
+			glDisable(capability);
+		}
+		gl_state.capabilities[capability] = enabled;
+	}
+}
+
+void gl_enable(GLenum capability) {
+	gl_set_capability(capability, true);
+}
+
+void gl_disable(GLenum capability) {
+	gl_set_capability(capability, false);
+}
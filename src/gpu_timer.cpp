@@ -0,0 +1,116 @@
+/*
+ * Per pass GPU timings from GL_TIMESTAMP queries. Every frame gets its own
+ * set of queries and results are read GPU_TIMER_LATENCY frames later, when
+ * they are normally available, so reading them never stalls the pipeline.
+ * A frame whose queries are still in flight when its slot comes around again
+ * is simply not timed.
+ */
+#define GPU_TIMER_LATENCY 4
+#define GPU_TIMER_MAX_PASSES 8
+
+struct GpuTimerFrame {
+	GLuint queries[GPU_TIMER_MAX_PASSES][2];
+	bool used[GPU_TIMER_MAX_PASSES];
+	bool pending;
+	bool skipped;
+};
+
+struct GpuTimers {
+	GpuTimerFrame frames[GPU_TIMER_LATENCY];
+	int current;
+	int pass_count;
+
+	/* latest available result per pass, in milliseconds */
+	float pass_ms[GPU_TIMER_MAX_PASSES];
+
+	void init(int passes) {
+		pass_count = std::min(passes, GPU_TIMER_MAX_PASSES);
+		current = 0;
+
+		for (int i = 0; i < GPU_TIMER_LATENCY; ++i) {
+			GpuTimerFrame *frame = &frames[i];
+			glGenQueries(GPU_TIMER_MAX_PASSES * 2, &frame->queries[0][0]);
+			frame->pending = false;
+			frame->skipped = false;
+		}
+
+		for (int i = 0; i < GPU_TIMER_MAX_PASSES; ++i) {
+			pass_ms[i] = 0.0f;
+		}
+	}
+
+	void destroy() {
+		for (int i = 0; i < GPU_TIMER_LATENCY; ++i) {
+			glDeleteQueries(GPU_TIMER_MAX_PASSES * 2, &frames[i].queries[0][0]);
+		}
+	}
+
+	bool collect(GpuTimerFrame *frame) {
+		GLuint last_query = 0;
+		for (int pass = 0; pass < pass_count; ++pass) {
+			if (frame->used[pass]) {
+				last_query = frame->queries[pass][1];
+			}
+		}
+
+		if (last_query) {
+			GLint available = 0;
+			glGetQueryObjectiv(last_query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return false;
+			}
+		}
+
+		for (int pass = 0; pass < pass_count; ++pass) {
+			if (!frame->used[pass]) {
+				pass_ms[pass] = 0.0f;
+				continue;
+			}
+
+			GLuint64 start, end;
+			glGetQueryObjectui64v(frame->queries[pass][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(frame->queries[pass][1], GL_QUERY_RESULT, &end);
+			pass_ms[pass] = (end - start) / 1000000.0f;
+		}
+
+		return true;
+	}
+
+	void begin_frame() {
+		GpuTimerFrame *frame = &frames[current];
+
+		if (frame->pending && !collect(frame)) {
+			frame->skipped = true;
+			return;
+		}
+
+		frame->pending = false;
+		frame->skipped = false;
+		for (int pass = 0; pass < pass_count; ++pass) {
+			frame->used[pass] = false;
+		}
+	}
+
+	void begin(int pass) {
+		GpuTimerFrame *frame = &frames[current];
+		if (!frame->skipped) {
+			glQueryCounter(frame->queries[pass][0], GL_TIMESTAMP);
+		}
+	}
+
+	void end(int pass) {
+		GpuTimerFrame *frame = &frames[current];
+		if (!frame->skipped) {
+			glQueryCounter(frame->queries[pass][1], GL_TIMESTAMP);
+			frame->used[pass] = true;
+		}
+	}
+
+	void end_frame() {
+		GpuTimerFrame *frame = &frames[current];
+		if (!frame->skipped) {
+			frame->pending = true;
+		}
+		current = (current + 1) % GPU_TIMER_LATENCY;
+	}
+};
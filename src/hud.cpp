@@ -0,0 +1,290 @@
+/*
+ * Immediate mode overlay for text, rectangles, lines and graphs in window
+ * pixels (origin top left). Everything is batched into one vertex array that
+ * is streamed and drawn with a single draw call in hud_draw. Text uses an
+ * embedded 5x7 font; the bottom row of the font texture is white so solid
+ * shapes sample the same texture and need no state change.
+ */
+#define HUD_GLYPH_FIRST 32
+#define HUD_GLYPH_COUNT 64
+#define HUD_GLYPH_WIDTH 5
+#define HUD_GLYPH_HEIGHT 7
+#define HUD_CELL_WIDTH 6 /* glyph plus one column of spacing */
+#define HUD_CELL_HEIGHT 9
+#define HUD_SCALE 2
+
+#define HUD_FONT_WIDTH (HUD_GLYPH_COUNT * HUD_CELL_WIDTH)
+#define HUD_FONT_HEIGHT 8
+
+#define HUD_MAX_VERTICES 32768
+#define HUD_HISTORY 240
+
+#define ATTRIB_HUD_POSITION 0
+#define ATTRIB_HUD_UV 1
+#define ATTRIB_HUD_COLOR 2
+
+/* ' ' through '_', one byte per column, bit 0 is the top row */
+static const unsigned char hud_font[HUD_GLYPH_COUNT][HUD_GLYPH_WIDTH] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 },
+	{ 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 }, { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },
+	{ 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x08, 0x2A, 0x1C, 0x2A, 0x08 }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+	{ 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },
+	{ 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 }, { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 },
+	{ 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+	{ 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },
+	{ 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 }, { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },
+	{ 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+	{ 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x49, 0x49, 0x7A },
+	{ 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 }, { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 },
+	{ 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+	{ 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 },
+	{ 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F }, { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F },
+	{ 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },
+	{ 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 },
+};
+
+struct HudVertex {
+	glm::vec2 pos;
+	glm::vec2 uv;
+	unsigned char color[4];
+};
+
+struct Hud {
+	bool visible;
+
+	Shader *shader;
+	GLuint vao;
+	Texture font;
+
+	TaggedVector<HudVertex, MEM_HUD> vertices;
+
+	/* frame times of the last HUD_HISTORY frames, head is the oldest */
+	float frame_ms[HUD_HISTORY];
+	float gpu_ms[HUD_HISTORY];
+	int history_head;
+	double last_frame_clock;
+};
+
+Texture create_hud_font() {
+	std::vector<unsigned char> pixels(HUD_FONT_WIDTH * HUD_FONT_HEIGHT, 0);
+
+	for (int glyph = 0; glyph < HUD_GLYPH_COUNT; ++glyph) {
+		for (int column = 0; column < HUD_GLYPH_WIDTH; ++column) {
+			for (int row = 0; row < HUD_GLYPH_HEIGHT; ++row) {
+				if (hud_font[glyph][column] & (1 << row)) {
+					pixels[row * HUD_FONT_WIDTH + glyph * HUD_CELL_WIDTH + column] = 255;
+				}
+			}
+		}
+	}
+
+	/* the last row is never covered by a glyph, it is the white texel */
+	memset(&pixels[(HUD_FONT_HEIGHT - 1) * HUD_FONT_WIDTH], 255, HUD_FONT_WIDTH);
+
+	Texture id;
+	glGenTextures(1, &id);
+	gl_bind_texture(GL_TEXTURE_2D, id);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, HUD_FONT_WIDTH, HUD_FONT_HEIGHT);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, HUD_FONT_WIDTH, HUD_FONT_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	gl_bind_texture(GL_TEXTURE_2D, 0);
+	gpu_memory_track(GPU_MEM_TEXTURE, id, HUD_FONT_WIDTH * HUD_FONT_HEIGHT, "hud font");
+	gl_label(GL_TEXTURE, id, "hud font");
+
+	return id;
+}
+
+/* vertices are streamed through buffer, the vao points at the start of it */
+void create_hud(Hud *hud, GLuint buffer) {
+	hud->visible = false;
+	hud->font = create_hud_font();
+
+	hud->shader = new Shader("resources/shader/hudVert.glsl", "resources/shader/hudFrag.glsl");
+	hud->shader->use();
+	hud->shader->load_int("font", 0);
+
+	glGenVertexArrays(1, &hud->vao);
+	gl_bind_vertex_array(hud->vao);
+	gl_label(GL_VERTEX_ARRAY, hud->vao, "hud");
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	glEnableVertexAttribArray(ATTRIB_HUD_POSITION);
+	glVertexAttribPointer(ATTRIB_HUD_POSITION, 2, GL_FLOAT, 0, sizeof(HudVertex), (void *)offsetof(HudVertex, pos));
+	glEnableVertexAttribArray(ATTRIB_HUD_UV);
+	glVertexAttribPointer(ATTRIB_HUD_UV, 2, GL_FLOAT, 0, sizeof(HudVertex), (void *)offsetof(HudVertex, uv));
+	glEnableVertexAttribArray(ATTRIB_HUD_COLOR);
+	glVertexAttribPointer(ATTRIB_HUD_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void *)offsetof(HudVertex, color));
+
+	hud->vertices.reserve(HUD_MAX_VERTICES);
+
+	for (int i = 0; i < HUD_HISTORY; ++i) {
+		hud->frame_ms[i] = 0.0f;
+		hud->gpu_ms[i] = 0.0f;
+	}
+	hud->history_head = 0;
+	hud->last_frame_clock = platform_clock();
+}
+
+void destroy_hud(Hud *hud) {
+	delete hud->shader;
+	delete_texture(hud->font);
+	gl_delete_vertex_array(hud->vao);
+	release(hud->vertices);
+}
+
+/* called once per frame whether or not the HUD is shown, so the graphs are full when it is */
+void hud_record_frame(Hud *hud, float gpu_ms) {
+	double now = platform_clock();
+
+	hud->frame_ms[hud->history_head] = (now - hud->last_frame_clock) * 1000.0;
+	hud->gpu_ms[hud->history_head] = gpu_ms;
+	hud->history_head = (hud->history_head + 1) % HUD_HISTORY;
+	hud->last_frame_clock = now;
+}
+
+float hud_average_frame_ms(Hud *hud) {
+	float sum = 0.0f;
+	for (int i = 0; i < HUD_HISTORY; ++i) {
+		sum += hud->frame_ms[i];
+	}
+	return sum / HUD_HISTORY;
+}
+
+void hud_push_vertex(Hud *hud, glm::vec2 pos, glm::vec2 uv, glm::vec4 color) {
+	HudVertex vertex;
+	vertex.pos = pos;
+	vertex.uv = uv;
+	for (int i = 0; i < 4; ++i) {
+		vertex.color[i] = (unsigned char)(glm::clamp(color[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+	hud->vertices.push_back(vertex);
+}
+
+/* corners in clockwise order; anything past HUD_MAX_VERTICES is dropped */
+void hud_quad(Hud *hud, glm::vec2 p0, glm::vec2 p1, glm::vec2 p2, glm::vec2 p3, glm::vec2 uv0, glm::vec2 uv1, glm::vec4 color) {
+	if (hud->vertices.size() + 6 > HUD_MAX_VERTICES) {
+		return;
+	}
+
+	hud_push_vertex(hud, p0, uv0, color);
+	hud_push_vertex(hud, p1, glm::vec2(uv1.x, uv0.y), color);
+	hud_push_vertex(hud, p2, uv1, color);
+
+	hud_push_vertex(hud, p0, uv0, color);
+	hud_push_vertex(hud, p2, uv1, color);
+	hud_push_vertex(hud, p3, glm::vec2(uv0.x, uv1.y), color);
+}
+
+glm::vec2 hud_white_texel() {
+	return glm::vec2(0.5f / HUD_FONT_WIDTH, (HUD_FONT_HEIGHT - 0.5f) / HUD_FONT_HEIGHT);
+}
+
+void hud_rect(Hud *hud, float x, float y, float w, float h, glm::vec4 color) {
+	glm::vec2 white = hud_white_texel();
+	hud_quad(hud, glm::vec2(x, y), glm::vec2(x + w, y), glm::vec2(x + w, y + h), glm::vec2(x, y + h), white, white, color);
+}
+
+void hud_line(Hud *hud, glm::vec2 from, glm::vec2 to, float thickness, glm::vec4 color) {
+	glm::vec2 direction = to - from;
+	float length = glm::length(direction);
+	if (length <= 0.0f) {
+		return;
+	}
+
+	glm::vec2 side = glm::vec2(-direction.y, direction.x) / length * (thickness * 0.5f);
+	glm::vec2 white = hud_white_texel();
+	hud_quad(hud, from - side, to - side, to + side, from + side, white, white, color);
+}
+
+/* returns the x coordinate after the last character */
+float hud_text(Hud *hud, float x, float y, const char *text, glm::vec4 color) {
+	float size_x = HUD_GLYPH_WIDTH * HUD_SCALE;
+	float size_y = HUD_GLYPH_HEIGHT * HUD_SCALE;
+
+	for (; *text; ++text) {
+		int c = toupper((unsigned char)*text) - HUD_GLYPH_FIRST;
+		if (c < 0 || c >= HUD_GLYPH_COUNT) {
+			c = '?' - HUD_GLYPH_FIRST;
+		}
+
+		if (c != 0) {
+			glm::vec2 uv0((float)(c * HUD_CELL_WIDTH) / HUD_FONT_WIDTH, 0.0f);
+			glm::vec2 uv1((float)(c * HUD_CELL_WIDTH + HUD_GLYPH_WIDTH) / HUD_FONT_WIDTH, (float)HUD_GLYPH_HEIGHT / HUD_FONT_HEIGHT);
+			hud_quad(hud, glm::vec2(x, y), glm::vec2(x + size_x, y), glm::vec2(x + size_x, y + size_y), glm::vec2(x, y + size_y), uv0, uv1, color);
+		}
+
+		x += HUD_CELL_WIDTH * HUD_SCALE;
+	}
+
+	return x;
+}
+
+float hud_printf(Hud *hud, float x, float y, glm::vec4 color, const char *format, ...) {
+	char text[256];
+
+	va_list args;
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	return hud_text(hud, x, y, text, color);
+}
+
+/* plots a ring buffer of HUD_HISTORY values, oldest at head, scaled so max_value is the top edge */
+void hud_graph(Hud *hud, float x, float y, float w, float h, const float *values, int head, float max_value, glm::vec4 color) {
+	float step = w / (HUD_HISTORY - 1);
+	glm::vec2 last;
+
+	for (int i = 0; i < HUD_HISTORY; ++i) {
+		float value = std::min(values[(head + i) % HUD_HISTORY], max_value);
+		glm::vec2 point(x + i * step, y + h - value / max_value * h);
+
+		if (i > 0) {
+			hud_line(hud, last, point, 1.5f, color);
+		}
+		last = point;
+	}
+}
+
+/* draws everything added this frame in one call and starts a new batch */
+void hud_draw(Hud *hud, StreamBuffer *stream, GLuint frame_buffer, int width, int height) {
+	GLsizei count = hud->vertices.size();
+	if (count == 0) {
+		return;
+	}
+
+	/* the scene took the whole region, the overlay sits this frame out */
+	GLuint first;
+	void *dst = stream->alloc(count, sizeof(HudVertex), &first);
+	if (!dst) {
+		render_stats.dropped++;
+		hud->vertices.clear();
+		return;
+	}
+	memcpy(dst, hud->vertices.data(), count * sizeof(HudVertex));
+	hud->vertices.clear();
+
+	gl_bind_framebuffer(frame_buffer);
+	gl_viewport(0, 0, width, height);
+	gl_disable(GL_DEPTH_TEST);
+	gl_disable(GL_CULL_FACE);
+
+	hud->shader->use();
+	hud->shader->load_vec2("screen_size", glm::vec2(width, height));
+	gl_active_texture(0);
+	gl_bind_texture(GL_TEXTURE_2D, hud->font);
+	gl_bind_vertex_array(hud->vao);
+
+	glDrawArrays(GL_TRIANGLES, first, count);
+
+	render_stats.draw_calls++;
+	render_stats.triangles += count / 3;
+
+	gl_enable(GL_DEPTH_TEST);
+	gl_enable(GL_CULL_FACE);
+}
@@ -0,0 +1,73 @@
+/*
+ * Worker thread pool for blocking work that must stay off the GL thread:
+ * file I/O and decoding. Jobs run in submission order on whichever worker
+ * is free and must not touch GL. The pool starts with the first submit and
+ * is joined by jobs_shutdown.
+ */
+#define JOBS_MAX_WORKERS 8
+
+struct JobPool {
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> queue;
+	std::vector<std::thread> workers;
+	bool stopping;
+};
+
+static JobPool job_pool;
+
+void job_worker_main() {
+	while (true) {
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(job_pool.mutex);
+			job_pool.wake.wait(lock, [] { return job_pool.stopping || !job_pool.queue.empty(); });
+
+			if (job_pool.queue.empty()) {
+				return;
+			}
+
+			job = std::move(job_pool.queue.front());
+			job_pool.queue.pop_front();
+		}
+
+		job();
+	}
+}
+
+/* one worker per core, leaving one to the GL thread */
+int job_worker_count() {
+	int cores = std::thread::hardware_concurrency();
+	return std::max(1, std::min(cores - 1, JOBS_MAX_WORKERS));
+}
+
+void jobs_submit(std::function<void()> job) {
+	std::lock_guard<std::mutex> lock(job_pool.mutex);
+
+	if (job_pool.workers.empty()) {
+		job_pool.stopping = false;
+		int count = job_worker_count();
+		for (int i = 0; i < count; ++i) {
+			job_pool.workers.push_back(std::thread(job_worker_main));
+		}
+		LOG(LOG_DEBUG, "Started job workers", log_int("count", count));
+	}
+
+	job_pool.queue.push_back(std::move(job));
+	job_pool.wake.notify_one();
+}
+
+/* runs what is still queued, then joins the workers */
+void jobs_shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(job_pool.mutex);
+		job_pool.stopping = true;
+	}
+	job_pool.wake.notify_all();
+
+	for (std::thread &worker : job_pool.workers) {
+		worker.join();
+	}
+	job_pool.workers.clear();
+}
@@ -1,13 +1,391 @@
-#define LOG_INFO "INFO"
-#define LOG_WARNING "WARNING"
-#define LOG_ERROR "ERROR"
-#define LOG_FATAL "FATAL"
+/*
+ * Asynchronous logging. LOG(level, message, fields...) copies the message and
+ * its structured fields into a fixed size record in a lock-free ring buffer
+ * and returns; a background thread formats the records and writes them to
+ * stdout, an optional text file and an optional binary log. When the ring is
+ * full records are dropped and counted rather than blocking the caller.
+ *
+ * Levels below LOG_MIN_LEVEL compile to nothing, including their arguments.
+ * Field keys must be string literals, string values are copied.
+ *
+ *   LOG(LOG_INFO, "Loaded texture", log_str("path", path), log_int("bytes", size));
+ *
+ * Binary format (native byte order): "PLOG", u32 version, then per record
+ *   f64 time_us, u32 thread, u8 level, u8 field_count, u16 message_length,
+ *   message bytes, and per field u8 type, u8 key_length, key bytes, then an
+ *   i64 or f64 value, or u16 length and bytes for strings.
+ */
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARNING 2
+#define LOG_ERROR 3
+#define LOG_FATAL 4
 
-void log(const char *level, const char *msg) {
-	printf("[%s] %s\n", level, msg);
+#ifndef LOG_MIN_LEVEL
+#ifdef DEBUG
+#define LOG_MIN_LEVEL LOG_DEBUG
+#else
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
+#endif
+
+#define LOG(level, ...) do { if ((level) >= LOG_MIN_LEVEL) log_write((level), __VA_ARGS__); } while (0)
+
+#define LOG_RING_SIZE 4096 /* power of two */
+#define LOG_RECORD_SIZE 512
+#define LOG_MAX_FIELDS 8
+#define LOG_BINARY_VERSION 1
+
+#define LOG_FIELD_INT 0
+#define LOG_FIELD_FLOAT 1
+#define LOG_FIELD_STRING 2
+
+const char *log_level_names[] = { "DEBUG", "INFO", "WARNING", "ERROR", "FATAL" };
+
+struct LogField {
+	const char *key;
+	int type;
+	union {
+		int64_t i;
+		double f;
+		const char *s;
+		size_t offset; /* of a string value in the record's text, once queued */
+	};
+};
+
+LogField log_int(const char *key, int64_t value) {
+	LogField field;
+	field.key = key;
+	field.type = LOG_FIELD_INT;
+	field.i = value;
+	return field;
+}
+
+LogField log_float(const char *key, double value) {
+	LogField field;
+	field.key = key;
+	field.type = LOG_FIELD_FLOAT;
+	field.f = value;
+	return field;
+}
+
+LogField log_str(const char *key, const char *value) {
+	LogField field;
+	field.key = key;
+	field.type = LOG_FIELD_STRING;
+	field.s = value;
+	return field;
+}
+
+#define LOG_TEXT_SIZE (LOG_RECORD_SIZE - 16 - LOG_MAX_FIELDS * sizeof(LogField))
+
+/* the message and string values are stored back to back in text, each zero terminated */
+struct LogRecord {
+	double time_us;
+	uint32_t thread;
+	uint8_t level;
+	uint8_t field_count;
+	uint16_t text_used;
+	LogField fields[LOG_MAX_FIELDS];
+	char text[LOG_TEXT_SIZE];
+};
+
+static_assert(sizeof(LogRecord) == LOG_RECORD_SIZE, "log records must have a fixed size");
+
+struct LogSlot {
+	std::atomic<size_t> sequence;
+	LogRecord record;
+};
+
+/*
+ * Bounded multi producer queue: a slot's sequence tells whether it is free
+ * for position pos (sequence == pos) or holds the record for it
+ * (sequence == pos + 1). Only the logger thread consumes.
+ */
+struct Logger {
+	LogSlot slots[LOG_RING_SIZE];
+	std::atomic<size_t> enqueue_pos;
+	std::atomic<size_t> dequeue_pos;
+	std::atomic<size_t> dropped;
+
+	std::atomic<FILE *> text_file;
+	std::atomic<FILE *> binary_file;
+
+	std::atomic<bool> running;
+	std::thread thread;
+	double start_us;
+
+	Logger();
+	~Logger();
+};
+
+static Logger logger;
+
+double log_clock_us() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint32_t log_thread_id() {
+	static std::atomic<uint32_t> next_id(1);
+	thread_local uint32_t id = next_id.fetch_add(1);
+	return id;
+}
+
+size_t log_copy_text(LogRecord *record, const char *str) {
+	size_t offset = record->text_used;
+
+	/* text is full, its last byte is the terminator of the last string and reads as an empty one */
+	if (offset >= LOG_TEXT_SIZE) {
+		return LOG_TEXT_SIZE - 1;
+	}
+
+	size_t length = strnlen(str, LOG_TEXT_SIZE);
+
+	/* truncate to what is left, always keeping the terminator */
+	if (offset + length + 1 > LOG_TEXT_SIZE) {
+		length = LOG_TEXT_SIZE - offset - 1;
+	}
+
+	memcpy(&record->text[offset], str, length);
+	record->text[offset + length] = 0;
+	record->text_used = offset + length + 1;
+
+	return offset;
+}
+
+void log_push(int level, const char *message, const LogField *fields, int field_count) {
+	size_t pos = logger.enqueue_pos.load(std::memory_order_relaxed);
+	LogSlot *slot;
+
+	while (true) {
+		slot = &logger.slots[pos & (LOG_RING_SIZE - 1)];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+		if (diff == 0) {
+			if (logger.enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			logger.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = logger.enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	LogRecord *record = &slot->record;
+	record->time_us = log_clock_us() - logger.start_us;
+	record->thread = log_thread_id();
+	record->level = level;
+	record->field_count = std::min(field_count, LOG_MAX_FIELDS);
+	record->text_used = 0;
+	log_copy_text(record, message);
+
+	for (int i = 0; i < record->field_count; ++i) {
+		record->fields[i] = fields[i];
+		if (fields[i].type == LOG_FIELD_STRING) {
+			record->fields[i].offset = log_copy_text(record, fields[i].s ? fields[i].s : "");
+		}
+	}
+
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+template <typename... Fields>
+void log_write(int level, const char *message, Fields... fields) {
+	LogField list[] = { fields..., LogField() };
+	log_push(level, message, list, sizeof...(fields));
+}
+
+void log_write_text(FILE *out, const LogRecord *record) {
+	fprintf(out, "[%10.3f] [%s] %s", record->time_us / 1000.0, log_level_names[record->level], record->text);
+
+	for (int i = 0; i < record->field_count; ++i) {
+		const LogField *field = &record->fields[i];
+		switch (field->type) {
+		case LOG_FIELD_INT:
+			fprintf(out, " %s=%lld", field->key, (long long)field->i);
+			break;
+		case LOG_FIELD_FLOAT:
+			fprintf(out, " %s=%.3f", field->key, field->f);
+			break;
+		case LOG_FIELD_STRING:
+			fprintf(out, " %s=%s", field->key, &record->text[field->offset]);
+			break;
+		}
+	}
+
+	fputc('\n', out);
+}
+
+void log_write_binary_string(FILE *out, const char *str, bool wide_length) {
+	size_t length = strlen(str);
+
+	if (wide_length) {
+		uint16_t length16 = length;
+		fwrite(&length16, sizeof(length16), 1, out);
+	} else {
+		uint8_t length8 = std::min(length, (size_t)255);
+		length = length8;
+		fwrite(&length8, sizeof(length8), 1, out);
+	}
+
+	fwrite(str, 1, length, out);
+}
+
+void log_write_binary(FILE *out, const LogRecord *record) {
+	fwrite(&record->time_us, sizeof(record->time_us), 1, out);
+	fwrite(&record->thread, sizeof(record->thread), 1, out);
+	fwrite(&record->level, sizeof(record->level), 1, out);
+	fwrite(&record->field_count, sizeof(record->field_count), 1, out);
+	log_write_binary_string(out, record->text, true);
+
+	for (int i = 0; i < record->field_count; ++i) {
+		const LogField *field = &record->fields[i];
+		uint8_t type = field->type;
+		fwrite(&type, sizeof(type), 1, out);
+		log_write_binary_string(out, field->key, false);
+
+		switch (field->type) {
+		case LOG_FIELD_INT:
+			fwrite(&field->i, sizeof(field->i), 1, out);
+			break;
+		case LOG_FIELD_FLOAT:
+			fwrite(&field->f, sizeof(field->f), 1, out);
+			break;
+		case LOG_FIELD_STRING:
+			log_write_binary_string(out, &record->text[field->offset], true);
+			break;
+		}
+	}
+}
+
+/* only ever called from one thread at a time: the logger thread, or the caller once it is gone */
+bool log_drain_one() {
+	size_t pos = logger.dequeue_pos.load(std::memory_order_relaxed);
+	LogSlot *slot = &logger.slots[pos & (LOG_RING_SIZE - 1)];
+
+	if (slot->sequence.load(std::memory_order_acquire) != pos + 1) {
+		return false;
+	}
+
+	LogRecord *record = &slot->record;
+	log_write_text(stdout, record);
+
+	FILE *text_file = logger.text_file.load();
+	if (text_file) {
+		log_write_text(text_file, record);
+	}
+
+	FILE *binary_file = logger.binary_file.load();
+	if (binary_file) {
+		log_write_binary(binary_file, record);
+	}
+
+	slot->sequence.store(pos + LOG_RING_SIZE, std::memory_order_release);
+	logger.dequeue_pos.store(pos + 1, std::memory_order_release);
+
+	return true;
+}
+
+void log_drain() {
+	bool wrote = false;
+	while (log_drain_one()) {
+		wrote = true;
+	}
+
+	size_t dropped = logger.dropped.exchange(0);
+	if (dropped > 0) {
+		fprintf(stdout, "[WARNING] Log ring buffer full, dropped %zu records\n", dropped);
+	}
+
+	if (wrote) {
+		fflush(stdout);
+		FILE *text_file = logger.text_file.load();
+		if (text_file) fflush(text_file);
+		FILE *binary_file = logger.binary_file.load();
+		if (binary_file) fflush(binary_file);
+	}
+}
+
+void log_thread_main() {
+	while (logger.running.load()) {
+		log_drain();
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	log_drain();
+}
+
+Logger::Logger() {
+	for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	enqueue_pos = 0;
+	dequeue_pos = 0;
+	dropped = 0;
+	text_file = 0;
+	binary_file = 0;
+	start_us = log_clock_us();
+
+	running = true;
+	thread = std::thread(log_thread_main);
+}
+
+Logger::~Logger() {
+	running = false;
+	if (thread.joinable()) {
+		thread.join();
+	}
+
+	FILE *files[] = { text_file.exchange(0), binary_file.exchange(0) };
+	for (FILE *file : files) {
+		if (file) fclose(file);
+	}
+}
+
+/* blocks until everything logged before the call is written */
+void log_flush() {
+	size_t target = logger.enqueue_pos.load();
+
+	if (!logger.running.load()) {
+		log_drain();
+		return;
+	}
+
+	while (logger.dequeue_pos.load(std::memory_order_acquire) < target) {
+		std::this_thread::yield();
+	}
+}
+
+void log_swap_file(std::atomic<FILE *> *sink, FILE *file) {
+	log_flush();
+	FILE *old = sink->exchange(file);
+	log_flush();
+	if (old) fclose(old);
+}
+
+/* also writes the text log to path, null closes it */
+bool log_open_text(const char *path) {
+	FILE *file = path ? fopen(path, "w") : 0;
+	log_swap_file(&logger.text_file, file);
+	return !path || file;
+}
+
+bool log_open_binary(const char *path) {
+	FILE *file = path ? fopen(path, "wb") : 0;
+	if (file) {
+		uint32_t version = LOG_BINARY_VERSION;
+		fwrite("PLOG", 1, 4, file);
+		fwrite(&version, sizeof(version), 1, file);
+	}
+	log_swap_file(&logger.binary_file, file);
+	return !path || file;
 }
 
 void die(const char *msg) {
-	log(LOG_FATAL, msg);
+	log_write(LOG_FATAL, msg);
+	log_flush();
 	exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
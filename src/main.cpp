@@ -2,35 +2,119 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <unordered_map>
+#include <algorithm>
+#include <cstdarg>
+#include <cfloat>
+#include <climits>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#ifdef PLATFORMER_USE_ASSIMP
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#endif
+
+#include "platformer.h"
 
+/* decoded images are counted as texture memory */
+#define STBI_MALLOC(size) mem_alloc(MEM_TEXTURE, size)
+#define STBI_REALLOC(ptr, size) mem_realloc(MEM_TEXTURE, ptr, size)
+#define STBI_FREE(ptr) mem_free(ptr)
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-#include "platformer.h"
-
 #include "log.cpp"
+#include "profiler.cpp"
+#include "memory.cpp"
+#include "gl_state.cpp"
+#include "gl_debug.cpp"
+#include "mapped_file.cpp"
+#include "pack.cpp"
+#include "texture.cpp"
 #include "gfx.cpp"
+#include "stream_buffer.cpp"
+#include "render_queue.cpp"
+#include "resolution.cpp"
+#include "gpu_timer.cpp"
+#include "platform.cpp"
+#include "jobs.cpp"
+#include "async_io.cpp"
+#include "mesh.cpp"
+#include "obj.cpp"
+#include "mesh_optimize.cpp"
+#include "mesh_simplify.cpp"
 #include "model.cpp"
+#include "asset_loader.cpp"
+#include "resources.cpp"
+#include "hud.cpp"
 
 #define ID_CUBE 1
 #define ID_CRATE 2
 
-#define WATER_TEX_W 1280
-#define WATER_TEX_H 720
+#define SCENE_SAMPLES 4
+
+/* every mesh the world shader draws, which is compiled for it */
+#define WORLD_MESH_FORMAT MESH_FORMAT_QUANTIZED
+
+/* how far the camera may move, in world units, before the water texture is refreshed */
+#define WATER_REFRESH_DISTANCE 0.05f
+
+#define INSTANCE_STREAM_CAPACITY 65536
+
+#define FRAME_PASS_WATER 0
+#define FRAME_PASS_MAIN 1
+#define FRAME_PASS_PRESENT 2
+#define FRAME_PASS_COUNT 3
+
+const char *frame_pass_names[FRAME_PASS_COUNT] = { "water", "main", "present" };
 
 struct Player {
 	float x = 7.0;
@@ -40,8 +124,8 @@ struct Player {
 	float last_x = x;
 	float last_z = z;
 
-	Texture texture;
-	ComplexModel *model;
+	int texture_layer;
+	ResourceHandle model;
 };
 
 struct Block {
@@ -87,7 +171,14 @@ struct Block {
 };
 
 struct World {
-	std::vector<Block> blocks;
+	TaggedVector<Block, MEM_WORLD> blocks;
+
+	/*
+	 * Bumped whenever the world is replaced or a block below the water plane
+	 * moves, which is everything the water pass draws; lets it keep what it
+	 * drew. Blocks moving above the water leave it alone.
+	 */
+	unsigned int version = 0;
 	
 	bool has_block(int x, int y, int z) {
 		for (const Block &block : blocks) {
@@ -102,10 +193,17 @@ struct World {
 struct Water {
 	GLuint frame_buffer;
 	GLuint frame_buffer_texture;
+	int width;
+	int height;
 
-	Texture water_texture;
+	ResourceHandle water_texture;
 	SimpleModel *model;
-	Shader *shader;
+	ResourceHandle shader;
+
+	/* what the frame buffer texture currently shows */
+	bool cache_valid = false;
+	unsigned int cached_world_version;
+	glm::vec3 cached_eye;
 };
 
 struct Camera {
@@ -116,8 +214,20 @@ struct Camera {
 };
 
 struct Platformer {
+	Platform *platform;
 	PositionalLight *light;
-	Shader *shader;
+	ResourceHandle shader;
+	StreamBuffer *instances;
+	AssetLoader assets;
+	ResourceRegistry resources;
+	RenderQueue render_queue;
+	RenderTarget scene;
+	ResolutionScaler scaler;
+
+	/* CPU time spent issuing each pass last frame */
+	double pass_cpu_ms[FRAME_PASS_COUNT];
+	GpuTimers gpu_timers;
+	Hud hud;
 	Camera camera;
 	World world;
 	Player player;
@@ -127,8 +237,9 @@ struct Platformer {
 	int height;
 	
 	glm::mat4 proj_mat;
-	std::unordered_map<int, Texture> texture_atlas;
-	std::unordered_map<int, ComplexModel *> model_atlas;
+	ResourceHandle materials;
+	std::unordered_map<int, int> texture_atlas; /* block kind -> layer in materials */
+	std::unordered_map<int, ResourceHandle> model_atlas;
 };
 
 const int world_size_x = 32;
@@ -155,26 +266,15 @@ static bool keys_down[512];
 
 static Platformer *global_platformer;
 
-bool checkOpenGLError() {
-	bool found_error = false;
-	int glErr = glGetError();
-	while (glErr != GL_NO_ERROR) {
-		std::cout << "glError: " << glErr << "\n";
-		found_error = true;
-		glErr = glGetError();
-	}
-	return found_error;
-}
-
 std::string read_file(const char *file_path) {
-	std::string content, line = "";
-	std::ifstream file_stream(file_path, std::ios::in);
-
-	while (!file_stream.eof()) {
-		std::getline(file_stream, line);
-		content.append(line).append("\n");
+	VfsFile file;
+	if (!vfs_open(file_path, &file)) {
+		LOG(LOG_ERROR, "Failed to read file", log_str("path", file_path));
+		return std::string();
 	}
-	file_stream.close();
+
+	std::string content((const char *)file.data, file.size);
+	vfs_close(&file);
 	return content;
 }
 
@@ -190,60 +290,78 @@ PositionalLight *get_white_light(glm::vec3 pos) {
 	return new PositionalLight(pos, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec4(1.0f), glm::vec4(1.0f));
 }
 
+/* sizes the scene and water targets after the window and the current scales */
+void apply_resolution(Platformer *platformer) {
+	Water *water = &platformer->water;
+	ResolutionScaler *scaler = &platformer->scaler;
+
+	resize_render_target(&platformer->scene, scaled_size(platformer->width, scaler->main_scale), scaled_size(platformer->height, scaler->main_scale));
+
+	int water_width = scaled_size(platformer->width, scaler->water_scale);
+	int water_height = scaled_size(platformer->height, scaler->water_scale);
+	if (water->width != water_width || water->height != water_height) {
+		water->width = water_width;
+		water->height = water_height;
+		resize_texture_attachment(water->frame_buffer_texture, water_width, water_height);
+		water->cache_valid = false;
+	}
+}
+
 void frame_buffer_resize(GLFWwindow *window, int nwidth, int nheight) {
-	glViewport(0, 0, nwidth, nheight);
+	if (nwidth == 0 || nheight == 0) {
+		return;
+	}
+
 	global_platformer->proj_mat = glm::perspective(1.0472f, (float)nwidth / (float)nheight, 0.1f, 1000.0f);
 	global_platformer->width = nwidth;
 	global_platformer->height = nheight;
+	global_platformer->water.cache_valid = false;
+	apply_resolution(global_platformer);
 }
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
 	keys_down[key] = action != GLFW_RELEASE;
+
+	if (key == GLFW_KEY_F3 && action == GLFW_PRESS) {
+		global_platformer->hud.visible = !global_platformer->hud.visible;
+	}
+
+	if (key == GLFW_KEY_F4 && action == GLFW_PRESS) {
+		memory_report();
+	}
+
+#ifdef PLATFORMER_PROFILE
+	if (key == GLFW_KEY_F2 && action == GLFW_PRESS) {
+		if (!profiler_capturing()) {
+			profiler_start("trace.json");
+			LOG(LOG_INFO, "Profiler capture started");
+		} else if (profiler_stop()) {
+			LOG(LOG_INFO, "Profiler capture written", log_str("path", "trace.json"));
+		}
+	}
+#endif
 }
 
-void unbind_water_frame_buffer(Platformer *platformer) {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, platformer->width, platformer->height);
+void bind_scene_frame_buffer(Platformer *platformer) {
+	RenderTarget *scene = &platformer->scene;
+	gl_bind_framebuffer(scene->frame_buffer);
+	gl_viewport(0, 0, scene->width, scene->height);
 }
 
 void create_water_frame_buffer(Platformer *platformer, Water *water) {
+	water->width = scaled_size(platformer->width, platformer->scaler.water_scale);
+	water->height = scaled_size(platformer->height, platformer->scaler.water_scale);
 	water->frame_buffer = create_frame_buffer();
-	water->frame_buffer_texture = create_texture_attachment(WATER_TEX_W, WATER_TEX_H);
-	unbind_water_frame_buffer(platformer);
+	water->frame_buffer_texture = create_texture_attachment(water->width, water->height);
+	gl_label(GL_FRAMEBUFFER, water->frame_buffer, "water");
+	gl_label(GL_TEXTURE, water->frame_buffer_texture, "water color");
+	bind_scene_frame_buffer(platformer);
 }
 
 void bind_water_frame_buffer(Platformer *platformer, Water *water) {
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindFramebuffer(GL_FRAMEBUFFER, water->frame_buffer);
-	glViewport(0, 0, WATER_TEX_W, WATER_TEX_H);
-}
-
-GLFWwindow *create_window() {
-	if (!glfwInit()) {
-		die("Failed to initialize GLFW!");
-	}
-	
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-	glfwWindowHint(GLFW_SAMPLES, 4);
-
-	GLFWwindow *window = glfwCreateWindow(800, 600, "Platformer", 0, 0);
-
-	glfwMakeContextCurrent(window);
-
-	// vsync
-	// glfwSwapInterval(1);
-
-	if (glewInit() != GLEW_OK) {
-		die("Failed to initialize GLEW!");
-	}
-
-	glfwSetFramebufferSizeCallback(window, frame_buffer_resize);
-	glfwSetKeyCallback(window, key_callback);
-
-	glfwShowWindow(window);
-
-	return window;
+	gl_bind_texture(GL_TEXTURE_2D, 0);
+	gl_bind_framebuffer(water->frame_buffer);
+	gl_viewport(0, 0, water->width, water->height);
 }
 
 bool Block::colliding(Player *player) {
@@ -286,91 +404,216 @@ bool block_collisions(World *world, Block *block) {
 	return false;
 }
 
-void init(Platformer *platformer, GLFWwindow *window) {
-	platformer->shader = new Shader("resources/shader/vert.glsl", "resources/shader/frag.glsl");
-	platformer->light = get_white_light(glm::vec3(world_size_x / 2, 12, world_size_z / 2));
-
-	Texture color_palette = load_texture("resources/textures/colors.png");
-	platformer->texture_atlas[ID_CUBE] = load_texture("resources/textures/cube.png");
-	platformer->texture_atlas[ID_CRATE] = color_palette;
+/* the assets are still loading when this returns, draws that need one are skipped until it arrives */
+void init(Platformer *platformer, Platform *platform) {
+	PROFILE_ZONE("init");
 
-	platformer->model_atlas[ID_CUBE] = load_obj_file("resources/models/cube.obj");
-	platformer->model_atlas[ID_CRATE] = load_obj_file("resources/models/crate.obj");
+	int fwidth = platform->width;
+	int fheight = platform->height;
+	platformer->platform = platform;
+	platformer->width = fwidth;
+	platformer->height = fheight;
+	platformer->proj_mat = glm::perspective(1.0472f, (float)fwidth / (float)fheight, 0.1f, 1000.0f);
+	LOG(LOG_DEBUG, "Projection", log_str("matrix", glm::to_string(platformer->proj_mat).c_str()));
 
-	platformer->player.model = load_obj_file("resources/models/player.obj");
-	platformer->player.texture = color_palette;
+	platformer->scene = create_render_target(fwidth, fheight, SCENE_SAMPLES);
+	platformer->gpu_timers.init(FRAME_PASS_COUNT);
 
-	Shader *water_shader = new Shader("resources/shader/waterVert.glsl", "resources/shader/waterFrag.glsl");
-	water_shader->use();
-	water_shader->load_int("world_texture", 0);
-	water_shader->load_int("water_texture", 1);
-	water_shader->load_int("dudv_map", 2);
-	water_shader->load_mat4("model_matrix", glm::scale(glm::mat4(1.0), glm::vec3(world_size_x, 1.0, world_size_z)));
+	platformer->light = get_white_light(glm::vec3(world_size_x / 2, 12, world_size_z / 2));
+	platformer->instances = new StreamBuffer(sizeof(InstanceData) * INSTANCE_STREAM_CAPACITY);
+	resource_registry_init(&platformer->resources, &platformer->assets);
+
+	ResourceRegistry *resources = &platformer->resources;
+
+	platformer->shader = acquire_shader(resources, "resources/shader/vert.glsl", "resources/shader/frag.glsl", mesh_format_defines[WORLD_MESH_FORMAT], [platformer](Shader *shader) {
+		shader->use();
+		shader->load_int("materials", 0);
+		shader->load_mat4("proj_matrix", platformer->proj_mat);
+		shader->load_mat4("view_matrix", platformer->camera.view_matrix);
+		platformer->light->install(shader);
+	});
+
+	const char *material_paths[] = {
+		"resources/textures/cube.png",
+		"resources/textures/colors.png"
+	};
+	platformer->materials = acquire_texture_array(resources, material_paths, 2, [](Texture materials) {
+		gl_label(GL_TEXTURE, materials, "materials");
+	});
+	platformer->texture_atlas[ID_CUBE] = 0;
+	platformer->texture_atlas[ID_CRATE] = 1;
+
+	auto bind_instances = [platformer](ComplexModel *model) {
+		bind_instance_attributes(model->vao, platformer->instances->buffer);
+	};
+	platformer->model_atlas[ID_CUBE] = acquire_mesh(resources, "resources/models/cube.obj", WORLD_MESH_FORMAT, bind_instances);
+	platformer->model_atlas[ID_CRATE] = acquire_mesh(resources, "resources/models/crate.obj", WORLD_MESH_FORMAT, bind_instances);
+
+	platformer->player.model = acquire_mesh(resources, "resources/models/player.obj", WORLD_MESH_FORMAT, bind_instances);
+	platformer->player.texture_layer = 1;
+
+	create_hud(&platformer->hud, platformer->instances->buffer);
+
+	platformer->water.shader = acquire_shader(resources, "resources/shader/waterVert.glsl", "resources/shader/waterFrag.glsl", nullptr, [](Shader *water_shader) {
+		water_shader->use();
+		water_shader->load_int("world_texture", 0);
+		water_shader->load_int("water_texture", 1);
+		water_shader->load_int("dudv_map", 2);
+	});
+	platformer->water.water_texture = acquire_texture(resources, "resources/textures/water_texture.png", nullptr);
 	platformer->water.model = new SimpleModel((float *)&water_vertices[0], 18);
-	platformer->water.shader = water_shader;
-	platformer->water.water_texture = load_texture("resources/textures/water_texture.png");
 	create_water_frame_buffer(platformer, &platformer->water);
-
-	int fwidth, fheight;
-	glfwGetFramebufferSize(window, &fwidth, &fheight);
-	glViewport(0, 0, fwidth, fheight);
-	platformer->width = fwidth;
-	platformer->height = fheight;
-	platformer->proj_mat = glm::perspective(1.0472f, (float)fwidth / (float)fheight, 0.1f, 1000.0f);
-	std::cout << glm::to_string(platformer->proj_mat) << std::endl;
+	bind_instance_attributes(platformer->water.model->vao, platformer->instances->buffer);
 
 	glClearColor(0.53, 0.81, 0.92, 1.0);
-	
-	platformer->shader->use();
-	platformer->shader->load_int("color_palette", 0);
-	platformer->light->install(platformer->shader);
 
-	glEnable(GL_MULTISAMPLE);
-	glEnable(GL_BLEND);
+	gl_enable(GL_MULTISAMPLE);
+	gl_enable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	glEnable(GL_LINE_SMOOTH);
-	glEnable(GL_DEPTH_TEST);
+	gl_enable(GL_LINE_SMOOTH);
+	gl_enable(GL_DEPTH_TEST);
+}
+
+/* frees everything init created, the GL context must still be current */
+void destroy(Platformer *platformer) {
+	Water *water = &platformer->water;
+	ResourceRegistry *resources = &platformer->resources;
 
-	load_world(platformer, "resources/worlds/world1.txt");
+	/* loads still in flight land in the registry first */
+	asset_loader_destroy(&platformer->assets);
+	jobs_shutdown();
+	async_io_shutdown();
+
+	for (auto &entry : platformer->model_atlas) {
+		release_resource(resources, &entry.second);
+	}
+	platformer->model_atlas.clear();
+	release_resource(resources, &platformer->player.model);
+
+	delete water->model;
+	release_resource(resources, &water->shader);
+	release_resource(resources, &water->water_texture);
+	delete_texture(water->frame_buffer_texture);
+	gl_delete_framebuffer(water->frame_buffer);
+
+	release_resource(resources, &platformer->shader);
+	release_resource(resources, &platformer->materials);
+	resource_registry_destroy(resources);
+
+	delete platformer->light;
+	delete platformer->instances;
+
+	destroy_render_target(&platformer->scene);
+	destroy_hud(&platformer->hud);
+	platformer->gpu_timers.destroy();
+	platformer->render_queue.destroy();
+	release(platformer->world.blocks);
 }
 
-void load_world(Platformer *platformer, const char *file_name) {
-	World *world = &platformer->world;
-	Player *player = &platformer->player;
+/* a parsed world file, filled without touching the running game */
+struct WorldData {
+	TaggedVector<Block, MEM_WORLD> blocks;
+	bool has_player = false;
+	float player_x;
+	float player_z;
+};
 
-	world->blocks.clear();
-	std::ifstream in_file(file_name);
-	std::string line = "";
+/* one line of blocks per row of the file */
+void parse_world(const VfsFile *file, WorldData *data) {
+	PROFILE_ZONE("parse_world");
+
+	data->blocks.clear();
+
+	const char *cursor = (const char *)file->data;
+	const char *end = cursor + file->size;
 
 	int z = 0;
-	while (std::getline(in_file, line)) {
-		for (int x = 0; x < line.length(); ++x) {
-			char c = line[x];
+	while (cursor < end) {
+		const char *line_end = (const char *)memchr(cursor, '\n', end - cursor);
+		if (!line_end) {
+			line_end = end;
+		}
+
+		for (int x = 0; x < line_end - cursor; ++x) {
+			char c = cursor[x];
 
 			switch (c) {
 			case 'C':
-				world->blocks.push_back(Block(x, 0, z, ID_CUBE));
-				world->blocks.push_back(Block(x, 1, z, ID_CRATE));
+				data->blocks.push_back(Block(x, 0, z, ID_CUBE));
+				data->blocks.push_back(Block(x, 1, z, ID_CRATE));
 				break;
 			case 'X':
-				player->x = x;
-				player->z = z;
-				world->blocks.push_back(Block(x, 0, z, ID_CUBE));
+				data->has_player = true;
+				data->player_x = x;
+				data->player_z = z;
+				data->blocks.push_back(Block(x, 0, z, ID_CUBE));
 				break;
 			case 'G':
-				world->blocks.push_back(Block(x, 0, z, ID_CUBE));
+				data->blocks.push_back(Block(x, 0, z, ID_CUBE));
 				break;
 			case 'Q':
-				world->blocks.push_back(Block(x, 0, z, ID_CUBE));
-				world->blocks.push_back(Block(x, 1, z, ID_CUBE));
+				data->blocks.push_back(Block(x, 0, z, ID_CUBE));
+				data->blocks.push_back(Block(x, 1, z, ID_CUBE));
 				break;
 			case '0':
 				break;
 			}
 		}
 		z++;
+		cursor = line_end + 1;
+	}
+}
+
+void read_world(const char *file_name, WorldData *data) {
+	VfsFile file;
+	if (!vfs_open(file_name, &file)) {
+		LOG(LOG_ERROR, "Failed to open world", log_str("path", file_name));
+		data->blocks.clear();
+		return;
+	}
+
+	parse_world(&file, data);
+	vfs_close(&file);
+}
+
+void apply_world(Platformer *platformer, WorldData *data) {
+	World *world = &platformer->world;
+	Player *player = &platformer->player;
+
+	world->blocks.swap(data->blocks);
+	if (data->has_player) {
+		player->x = data->player_x;
+		player->z = data->player_z;
 	}
+
+	world->version++;
+}
+
+void load_world(Platformer *platformer, const char *file_name) {
+	PROFILE_ZONE("load_world");
+
+	WorldData data;
+	read_world(file_name, &data);
+	apply_world(platformer, &data);
+}
+
+/* reads and parses the file off the GL thread, the world switches over in a later asset_loader_update */
+void request_world(Platformer *platformer, const char *file_name) {
+	WorldData *data = new WorldData();
+
+	std::string path = file_name;
+
+	asset_request_files(&platformer->assets, { path }, [path, data](VfsFile *files) {
+		if (!files[0].data) {
+			LOG(LOG_ERROR, "Failed to open world", log_str("path", path.c_str()));
+		}
+		parse_world(&files[0], data);
+		return (size_t)0;
+	}, [platformer, data](AssetLoader *) {
+		apply_world(platformer, data);
+		delete data;
+	});
 }
 
 void reset_world(World *world) {
@@ -381,9 +624,13 @@ void reset_world(World *world) {
 		block->z = block->initial_z;
 		block->target_y = block->initial_y;
 	}
+
+	world->version++;
 }
 
 void move(Player *player, World *world) {
+	PROFILE_ZONE("move");
+
 	if (keys_down[GLFW_KEY_D]) {
 		float new_x = player->x + player_speed;
 		if (world->has_block(new_x + player_size - player_size_half, player->y - 1, player->z + player_size_half)) {
@@ -418,6 +665,11 @@ void move(Player *player, World *world) {
 
 		if (colliding) {
 			if (block->pushable()) {
+				/* pushes only move a block sideways, the water sees it if it is below the plane */
+				if (block->y < water_y) {
+					world->version++;
+				}
+
 				float x_move = (player->x - player->last_x) / 2.0;
 				float z_move = (player->z - player->last_z) / 2.0;
 
@@ -498,9 +750,11 @@ void move(Player *player, World *world) {
 }
 
 void update(Platformer *platformer) {
+	PROFILE_ZONE("update");
+
 	Player *player = &platformer->player;
 	Camera *camera = &platformer->camera;
-	Shader *shader = platformer->shader;
+	Shader *shader = get_shader(&platformer->resources, platformer->shader);
 	World *world = &platformer->world;
 		
 	move(player, world);
@@ -512,105 +766,425 @@ void update(Platformer *platformer) {
 
 	//camera->view_matrix = glm::translate(camera->view_matrix, glm::vec3(-platformer->camera.x, -8, -10 - platformer->camera.z));
 
-	shader->use();
-	shader->load_mat4("proj_matrix", platformer->proj_mat);
-	shader->load_mat4("view_matrix", platformer->camera.view_matrix);
+	if (shader) {
+		shader->use();
+		shader->load_mat4("proj_matrix", platformer->proj_mat);
+		shader->load_mat4("view_matrix", platformer->camera.view_matrix);
+	}
 
 	if (keys_down[GLFW_KEY_BACKSPACE]) {
 		reset_world(world);
 	}
 }
 
-void render_world(Platformer *platformer) {
-	Shader *shader = platformer->shader;
+void animate_blocks(World *world) {
+	for (int i = 0; i < world->blocks.size(); ++i) {
+		Block *block = &world->blocks[i];
+
+		/* two 0.005 steps per frame, the rate blocks fell at when each world pass advanced them */
+		for (int step = 0; step < 2; ++step) {
+			if (block->target_y < block->y) {
+				block->y -= 0.005;
+				if (block->y < water_y) {
+					world->version++;
+				}
+			}
+		}
+
+		block->model_matrix = glm::translate(glm::mat4(1.0), glm::vec3(block->x, block->y, block->z));
+	}
+}
+
+/* projected size in pixels of one unit at distance one */
+float lod_pixel_scale(Platformer *platformer) {
+	return platformer->proj_mat[1][1] * platformer->height * 0.5f;
+}
+
+glm::vec3 camera_eye(Camera *camera) {
+	return glm::vec3(glm::inverse(camera->view_matrix)[3]);
+}
+
+/* returns false when a block was left out because its resources are still loading */
+bool render_world(Platformer *platformer, bool water_pass) {
+	PROFILE_ZONE("render_world");
+
+	ResourceRegistry *resources = &platformer->resources;
+	Shader *shader = get_shader(resources, platformer->shader);
+	Texture materials = get_texture(resources, platformer->materials);
 	World *world = &platformer->world;
+	RenderQueue *queue = &platformer->render_queue;
+	bool complete = true;
 
-	shader->use();
+	if (!shader || !materials) {
+		return world->blocks.empty();
+	}
+
+	glm::vec3 eye = camera_eye(&platformer->camera);
+	float pixel_scale = lod_pixel_scale(platformer);
 
-	shader->load_vec4("block_color", glm::vec4(0.5, 0.3, 0.0, 1.0));
 	for (int i = 0; i < world->blocks.size(); ++i) {
 		Block *block = &world->blocks[i];
 
-		if (block->target_y < block->y) {
-			block->y -= 0.005;			
+		/* the water pass clips everything above the water plane */
+		if (water_pass && block->y >= water_y) {
+			continue;
 		}
 
-		bind_texture(platformer->texture_atlas[block->kind]);
-
-		block->model_matrix = glm::translate(glm::mat4(1.0), glm::vec3(block->x, block->y, block->z));
-		shader->load_mat4("model_matrix", block->model_matrix);
+		ComplexModel *model = get_mesh(resources, platformer->model_atlas[block->kind]);
+		if (!model) {
+			complete = false;
+			continue;
+		}
 
-		platformer->model_atlas[block->kind]->render();
+		DrawItem item = draw_item(shader, model, materials, platformer->texture_atlas[block->kind]);
+		use_lod(&item, model, select_lod(model, block->model_matrix, eye, pixel_scale));
+		item.instance.model_matrix = block->model_matrix;
+		item.instance.color = glm::vec4(0.5, 0.3, 0.0, 1.0);
+		queue->submit(item, RENDER_PASS_OPAQUE);
 	}
+
+	return complete;
 }
 
 void render_player(Platformer *platformer) {
+	ResourceRegistry *resources = &platformer->resources;
 	Player *player = &platformer->player;
-	Shader *shader = platformer->shader;
+	ComplexModel *model = get_mesh(resources, player->model);
+	Shader *shader = get_shader(resources, platformer->shader);
+	Texture materials = get_texture(resources, platformer->materials);
+
+	if (!model || !shader || !materials) {
+		return;
+	}
 
-	glm::mat4 model_matrix(1);
-	model_matrix = glm::translate(model_matrix, glm::vec3(player->x, player->y, player->z));
-	shader->load_mat4("model_matrix", model_matrix);
+	glm::mat4 model_matrix = glm::translate(glm::mat4(1), glm::vec3(player->x, player->y, player->z));
 
-	shader->load_vec4("block_color", glm::vec4(1.0));
-	bind_texture(player->texture);
-	player->model->render();
+	DrawItem item = draw_item(shader, model, materials, player->texture_layer);
+	use_lod(&item, model, select_lod(model, model_matrix, camera_eye(&platformer->camera), lod_pixel_scale(platformer)));
+	item.instance.model_matrix = model_matrix;
+	item.instance.color = glm::vec4(1.0);
+	platformer->render_queue.submit(item, RENDER_PASS_OPAQUE);
 }
 
 void render_water(Platformer *platformer) {
+	PROFILE_ZONE("render_water");
+
 	Water *water = &platformer->water;
-	Shader *water_shader = water->shader;
+	Shader *water_shader = get_shader(&platformer->resources, water->shader);
+	Texture water_texture = get_texture(&platformer->resources, water->water_texture);
+
+	if (!water_shader || !water_texture) {
+		return;
+	}
 
 	water_shader->use();
 	water_shader->load_mat4("proj_matrix", platformer->proj_mat);
 	water_shader->load_mat4("view_matrix", platformer->camera.view_matrix);
-	water_shader->load_float("move_factor", glfwGetTime());
+	water_shader->load_float("move_factor", platform_time(platformer->platform));
 
-	glActiveTexture(GL_TEXTURE0);
-	bind_texture(water->frame_buffer_texture);
-	glActiveTexture(GL_TEXTURE1);
-	bind_texture(water->water_texture);
-
-	water->model->render();
+	DrawItem item = draw_item(water_shader, water->model, water->frame_buffer_texture, water_texture);
+	item.instance.model_matrix = glm::scale(glm::mat4(1.0), glm::vec3(world_size_x, 1.0, world_size_z));
+	item.instance.color = glm::vec4(1.0);
+	platformer->render_queue.submit(item, RENDER_PASS_TRANSLUCENT);
 }
 
-void render(Platformer *platformer) {
+/*
+ * The water frame buffer only shows blocks below the water plane, so it is
+ * kept until one of those changes or the camera has moved further than
+ * WATER_REFRESH_DISTANCE; the camera eases towards the player and would
+ * otherwise refresh it every frame for a long tail of tiny steps.
+ */
+bool water_needs_refresh(Platformer *platformer) {
 	Water *water = &platformer->water;
 
-	glCullFace(GL_BACK);
-	glActiveTexture(GL_TEXTURE0);
+	if (!water->cache_valid || water->cached_world_version != platformer->world.version) {
+		return true;
+	}
+
+	return glm::distance(water->cached_eye, camera_eye(&platformer->camera)) > WATER_REFRESH_DISTANCE;
+}
+
+/* times one frame pass on the CPU and the GPU, and marks it as a GL debug group */
+struct PassScope {
+	Platformer *platformer;
+	int pass;
+	double start;
+
+	PassScope(Platformer *_platformer, int _pass) {
+		platformer = _platformer;
+		pass = _pass;
+		start = platform_clock();
+#ifdef PLATFORMER_GL_DEBUG
+		if (gl_debug_output) {
+			glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, pass, -1, frame_pass_names[pass]);
+		}
+#endif
+		platformer->gpu_timers.begin(pass);
+	}
+
+	~PassScope() {
+		platformer->gpu_timers.end(pass);
+#ifdef PLATFORMER_GL_DEBUG
+		if (gl_debug_output) {
+			glPopDebugGroup();
+		}
+#endif
+		platformer->pass_cpu_ms[pass] = (platform_clock() - start) * 1000.0;
+	}
+};
 
-	glEnable(GL_CLIP_DISTANCE0);
+void render_water_pass(Platformer *platformer) {
+	PROFILE_ZONE("water pass");
+	PassScope scope(platformer, FRAME_PASS_WATER);
+
+	Water *water = &platformer->water;
+	RenderQueue *queue = &platformer->render_queue;
+
+	gl_enable(GL_CLIP_DISTANCE0);
 	bind_water_frame_buffer(platformer, water);
 	glClear(GL_COLOR_BUFFER_BIT);
-	render_world(platformer);
-	unbind_water_frame_buffer(platformer);
-	glDisable(GL_CLIP_DISTANCE0);
+	queue->begin(platformer->camera.view_matrix);
+	/* a reflection missing blocks that are still loading is redrawn next frame */
+	bool complete = render_world(platformer, true);
+	queue->flush(platformer->instances);
+	gl_disable(GL_CLIP_DISTANCE0);
+
+	water->cache_valid = complete;
+	water->cached_world_version = platformer->world.version;
+	water->cached_eye = camera_eye(&platformer->camera);
+}
+
+void render_main_pass(Platformer *platformer) {
+	PROFILE_ZONE("main pass");
+	PassScope scope(platformer, FRAME_PASS_MAIN);
+
+	RenderQueue *queue = &platformer->render_queue;
 
-	glEnable(GL_CULL_FACE);
+	bind_scene_frame_buffer(platformer);
+	gl_enable(GL_CULL_FACE);
 	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-	
-	render_world(platformer);
+
+	queue->begin(platformer->camera.view_matrix);
+	render_world(platformer, false);
 	render_player(platformer);
 	render_water(platformer);
+	queue->flush(platformer->instances);
 }
 
-int main() {
-	GLFWwindow *window = create_window();
+void render_hud(Platformer *platformer) {
+	PROFILE_ZONE("render_hud");
+	GL_DEBUG_GROUP("hud");
+
+	Hud *hud = &platformer->hud;
+	World *world = &platformer->world;
+	GLStateCounters *counters = &gl_state.last_frame;
+	RenderStats *stats = &last_frame_render_stats;
+
+	const glm::vec4 background(0.0, 0.0, 0.0, 0.6);
+	const glm::vec4 text(1.0);
+	const glm::vec4 dim(0.7, 0.7, 0.7, 1.0);
+	const glm::vec4 cpu_color(0.3, 1.0, 0.3, 1.0);
+	const glm::vec4 gpu_color(1.0, 0.6, 0.2, 1.0);
+
+	float line = HUD_CELL_HEIGHT * HUD_SCALE;
+	float x = 16.0f;
+	float y = 16.0f;
+	float graph_w = 360.0f;
+	float graph_h = 80.0f;
+
+	int active = 0;
+	for (const Block &block : world->blocks) {
+		if (block.target_y < block.y) {
+			active++;
+		}
+	}
+
+	hud_rect(hud, x - 8, y - 8, graph_w + 16, graph_h + line * (FRAME_PASS_COUNT + 11) + 24, background);
+
+	float frame_ms = hud_average_frame_ms(hud);
+	hud_printf(hud, x, y, text, "%.2f ms  %.0f fps", frame_ms, frame_ms > 0.0f ? 1000.0f / frame_ms : 0.0f);
+	y += line + 4;
+
+	/* the frame budget line sits at half the graph height */
+	float max_ms = platformer->scaler.budget_ms * 2.0f;
+	hud_rect(hud, x, y, graph_w, graph_h, glm::vec4(0.0, 0.0, 0.0, 0.5));
+	hud_line(hud, glm::vec2(x, y + graph_h / 2), glm::vec2(x + graph_w, y + graph_h / 2), 1.0f, glm::vec4(1.0, 1.0, 1.0, 0.3));
+	hud_graph(hud, x, y, graph_w, graph_h, hud->frame_ms, hud->history_head, max_ms, cpu_color);
+	hud_graph(hud, x, y, graph_w, graph_h, hud->gpu_ms, hud->history_head, max_ms, gpu_color);
+	y += graph_h + 8;
+
+	float column = hud_text(hud, x, y, "frame ", cpu_color);
+	hud_text(hud, column, y, "gpu", gpu_color);
+	y += line;
+
+	hud_printf(hud, x, y, dim, "%-8s %8s %8s", "pass", "cpu ms", "gpu ms");
+	y += line;
+	for (int pass = 0; pass < FRAME_PASS_COUNT; ++pass) {
+		hud_printf(hud, x, y, text, "%-8s %8.3f %8.3f", frame_pass_names[pass], platformer->pass_cpu_ms[pass], platformer->gpu_timers.pass_ms[pass]);
+		y += line;
+	}
+	y += 4;
+
+	hud_printf(hud, x, y, text, "draws %u  instances %u", stats->draw_calls, stats->instances);
+	y += line;
+	hud_printf(hud, x, y, text, "triangles %u  dropped %u", stats->triangles, stats->dropped);
+	y += line;
+	hud_printf(hud, x, y, text, "state changes %d  skipped %d", counters->total_issued(), counters->total_skipped());
+	y += line;
+	hud_printf(hud, x, y, text, "blocks %d active  %d sleeping", active, (int)world->blocks.size() - active);
+	y += line;
+	hud_printf(hud, x, y, text, "memory %.1f mb  heap %.1f mb", platform_memory_usage() / (1024.0 * 1024.0), cpu_memory_total() / (1024.0 * 1024.0));
+	y += line;
+	hud_printf(hud, x, y, text, "world %.0f kb  render %.0f kb", cpu_memory_bytes(MEM_WORLD) / 1024.0, cpu_memory_bytes(MEM_RENDER) / 1024.0);
+	y += line;
+	hud_printf(hud, x, y, text, "gpu tex %.1f  buf %.1f  rt %.1f mb", gpu_memory_bytes(GPU_MEM_TEXTURE) / (1024.0 * 1024.0),
+		gpu_memory_bytes(GPU_MEM_BUFFER) / (1024.0 * 1024.0), gpu_memory_bytes(GPU_MEM_RENDER_TARGET) / (1024.0 * 1024.0));
+	y += line;
+	hud_printf(hud, x, y, text, "scale %.2f  water %.2f", platformer->scaler.main_scale, platformer->scaler.water_scale);
+
+	hud_draw(hud, platformer->instances, platformer->platform->back_buffer, platformer->width, platformer->height);
+}
+
+void present(Platformer *platformer) {
+	PROFILE_ZONE("present");
+	PassScope scope(platformer, FRAME_PASS_PRESENT);
+
+	present_render_target(&platformer->scene, platformer->platform->back_buffer, platformer->width, platformer->height);
+
+	if (platformer->hud.visible) {
+		render_hud(platformer);
+	}
+}
+
+/* GPU time of every pass of the last frame the timers have results for */
+float gpu_frame_ms(Platformer *platformer) {
+	float gpu_ms = 0.0f;
+	for (int pass = 0; pass < FRAME_PASS_COUNT; ++pass) {
+		gpu_ms += platformer->gpu_timers.pass_ms[pass];
+	}
+	return gpu_ms;
+}
+
+void render(Platformer *platformer) {
+	PROFILE_ZONE("render");
+
+	platformer->instances->begin_frame();
+	platformer->gpu_timers.begin_frame();
+
+	hud_record_frame(&platformer->hud, gpu_frame_ms(platformer));
+
+	for (int pass = 0; pass < FRAME_PASS_COUNT; ++pass) {
+		platformer->pass_cpu_ms[pass] = 0.0;
+	}
+
+	animate_blocks(&platformer->world);
+
+	glCullFace(GL_BACK);
+	gl_active_texture(0);
+
+	if (water_needs_refresh(platformer)) {
+		render_water_pass(platformer);
+	}
+
+	render_main_pass(platformer);
+	present(platformer);
+
+	platformer->gpu_timers.end_frame();
+	platformer->instances->end_frame();
+	gl_state_end_frame();
+	render_stats_end_frame();
+}
+
+#ifndef PLATFORMER_NO_MAIN
+int main(int argc, char **argv) {
+	double start_time = platform_clock();
+	bool first_frame = true;
+	bool headless = false;
+	int frame_limit = -1;
+	const char *screenshot_path = 0;
+	const char *world_path = "resources/worlds/world1.txt";
+	const char *trace_path = 0;
+	const char *pack_path = 0;
+	bool show_hud = false;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--headless")) {
+			headless = true;
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			frame_limit = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "--screenshot") && i + 1 < argc) {
+			screenshot_path = argv[++i];
+		} else if (!strcmp(argv[i], "--world") && i + 1 < argc) {
+			world_path = argv[++i];
+		} else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			trace_path = argv[++i];
+		} else if (!strcmp(argv[i], "--pack") && i + 1 < argc) {
+			pack_path = argv[++i];
+		} else if (!strcmp(argv[i], "--hud")) {
+			show_hud = true;
+		} else if (!strcmp(argv[i], "--log") && i + 1 < argc) {
+			if (!log_open_text(argv[++i])) {
+				die("Failed to open log file!");
+			}
+		} else if (!strcmp(argv[i], "--binary-log") && i + 1 < argc) {
+			if (!log_open_binary(argv[++i])) {
+				die("Failed to open binary log file!");
+			}
+		} else {
+			std::cout << "usage: " << argv[0] << " [--headless] [--frames n] [--screenshot out.ppm] [--world file] [--pack file] [--trace out.json] [--hud] [--log out.txt] [--binary-log out.bin]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (trace_path) {
+#ifdef PLATFORMER_PROFILE
+		profiler_start(trace_path);
+#else
+		LOG(LOG_WARNING, "Built without PLATFORMER_PROFILE, --trace is ignored");
+#endif
+	}
+
+	/* the default pack is optional, loose files are read when there is none */
+	uint64_t pack_size;
+	int64_t pack_mtime;
+	if (!pack_path && file_info(PACK_DEFAULT_PATH, &pack_size, &pack_mtime)) {
+		pack_path = PACK_DEFAULT_PATH;
+	}
+	if (pack_path && !vfs_mount(pack_path)) {
+		die("Failed to mount pack!");
+	}
+
+	Platform *platform = create_platform(800, 600, headless);
+	platform->frame_limit = frame_limit;
+
 	Platformer platformer;
 
 	global_platformer = &platformer;
 
-	init(&platformer, window);
+	init(&platformer, platform);
+	request_world(&platformer, world_path);
+	/* interactive runs start drawing right away, fixed timestep ones must show every asset from the first frame */
+	if (platform->fixed_timestep) {
+		asset_loader_finish(&platformer.assets);
+	}
+	platformer.hud.visible = show_hud;
+
+	/* fixed timestep runs must render the same pixels every time */
+	platformer.scaler.enabled = !platform->fixed_timestep;
 
 	int frames = 0;
-	double last_fps = glfwGetTime();
+	double last_fps = platform_time(platform);
 
-	double last = glfwGetTime();
-	while (!glfwWindowShouldClose(window)) {
-		double current = glfwGetTime();
+	double last = platform_time(platform);
+	while (!platform_should_close(platform)) {
+		double current = platform_time(platform);
 		double delta = current - last;
 
+		float *gpu_ms = platformer.gpu_timers.pass_ms;
+		if (platformer.scaler.update(gpu_frame_ms(&platformer), gpu_ms[FRAME_PASS_MAIN], gpu_ms[FRAME_PASS_WATER])) {
+			apply_resolution(&platformer);
+		}
+
 		if (delta >= 1.0 / 60.0) {
 			update(&platformer);
 
@@ -619,18 +1193,41 @@ int main() {
 
 		frames++;
 		if (current - last_fps >= 1.0) {
-			std::cout << frames << " FPS\n";
+			GLStateCounters *counters = &gl_state.last_frame;
+			LOG(LOG_INFO, "Frame stats", log_int("fps", frames), log_int("state_changes", counters->total_issued()), log_int("skipped", counters->total_skipped()),
+				log_float("water_gpu_ms", gpu_ms[FRAME_PASS_WATER]), log_float("main_gpu_ms", gpu_ms[FRAME_PASS_MAIN]), log_float("present_gpu_ms", gpu_ms[FRAME_PASS_PRESENT]));
 			frames = 0;
 			last_fps = current;
 		}
 
 		render(&platformer);
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		platform_swap(platform);
+
+		if (first_frame) {
+			LOG(LOG_INFO, "First frame", log_float("ms", (platform_clock() - start_time) * 1000.0));
+			first_frame = false;
+		}
+
+		asset_loader_update(&platformer.assets, ASSET_UPLOAD_BUDGET_MS);
+	}
+
+	if (screenshot_path && !platform_save_screenshot(platform, screenshot_path)) {
+		LOG(LOG_ERROR, "Failed to write screenshot!", log_str("path", screenshot_path));
 	}
 
-	glfwTerminate();
+	memory_report();
+	destroy(&platformer);
+	destroy_platform(platform);
+	vfs_unmount_all();
+	memory_leak_report();
+
+#ifdef PLATFORMER_PROFILE
+	if (profiler_capturing() && !profiler_stop()) {
+		LOG(LOG_ERROR, "Failed to write profiler trace!");
+	}
+#endif
 
 	return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Read-only memory mapped files. The mapping is only valid until
+ * unmap_file; loaders read straight out of it instead of copying the file.
+ * An empty file cannot be mapped and opens as a view with no data and size 0.
+ */
+struct MappedFile {
+	const unsigned char *data;
+	size_t size;
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+};
+
+bool map_file(MappedFile *mapped, const char *path) {
+	mapped->data = 0;
+	mapped->size = 0;
+
+#ifdef _WIN32
+	mapped->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+	if (mapped->file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mapped->file, &size)) {
+		CloseHandle(mapped->file);
+		return false;
+	}
+
+	if (size.QuadPart == 0) {
+		CloseHandle(mapped->file);
+		return true;
+	}
+
+	mapped->mapping = CreateFileMappingA(mapped->file, 0, PAGE_READONLY, 0, 0, 0);
+	if (!mapped->mapping) {
+		CloseHandle(mapped->file);
+		return false;
+	}
+
+	mapped->data = (const unsigned char *)MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!mapped->data) {
+		CloseHandle(mapped->mapping);
+		CloseHandle(mapped->file);
+		return false;
+	}
+	mapped->size = size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return true;
+	}
+
+	void *data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	/* the mapping keeps the file alive */
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	mapped->data = (const unsigned char *)data;
+	mapped->size = st.st_size;
+#endif
+
+	return true;
+}
+
+void unmap_file(MappedFile *mapped) {
+	if (!mapped->data) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapped->data);
+	CloseHandle(mapped->mapping);
+	CloseHandle(mapped->file);
+#else
+	munmap((void *)mapped->data, mapped->size);
+#endif
+
+	mapped->data = 0;
+	mapped->size = 0;
+}
+
+/* size and modification time, false if the file does not exist */
+bool file_info(const char *path, uint64_t *size, int64_t *mtime) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return false;
+	}
+
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+}
+
+bool has_extension(const char *path, const char *extension) {
+	size_t length = strlen(path), extension_length = strlen(extension);
+	return length >= extension_length && !strcmp(path + length - extension_length, extension);
+}
+
+/* source_path with its extension replaced, where the Bake tool writes its output */
+std::string baked_path(const char *source_path, const char *extension) {
+	std::string path = source_path;
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		path.erase(dot);
+	}
+
+	return path + extension;
+}
+
+/* whether the source differs from the size and time a bake recorded */
+bool source_changed(const char *source_path, uint64_t size, int64_t mtime) {
+	uint64_t current_size;
+	int64_t current_mtime;
+
+	/* a bake without its source is all there is */
+	if (!file_info(source_path, &current_size, &current_mtime)) {
+		return false;
+	}
+
+	return current_size != size || current_mtime != mtime;
+}
+
+/* every file below directory, recursively, as directory/relative/path */
+void list_files(const char *directory, std::vector<std::string> *paths) {
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((std::string(directory) + "/*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	do {
+		std::string name = entry.cFileName;
+		if (name == "." || name == "..") {
+			continue;
+		}
+
+		std::string path = std::string(directory) + "/" + name;
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+			list_files(path.c_str(), paths);
+		} else {
+			paths->push_back(path);
+		}
+	} while (FindNextFileA(find, &entry));
+
+	FindClose(find);
+#else
+	DIR *dir = opendir(directory);
+	if (!dir) {
+		return;
+	}
+
+	while (struct dirent *entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if (name == "." || name == "..") {
+			continue;
+		}
+
+		std::string path = std::string(directory) + "/" + name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+			continue;
+		}
+
+		if (S_ISDIR(st.st_mode)) {
+			list_files(path.c_str(), paths);
+		} else if (S_ISREG(st.st_mode)) {
+			paths->push_back(path);
+		}
+	}
+
+	closedir(dir);
+#endif
+}
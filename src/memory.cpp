@@ -0,0 +1,236 @@
+/*
+ * Memory accounting. CPU heap allocations made through mem_alloc (and the
+ * TaggedAllocator for containers) carry a small header with their size and
+ * subsystem tag, so live bytes, peaks and allocation counts are known per
+ * subsystem. GPU resources are registered by GL name with the size of their
+ * storage when it is specified and released when they are deleted; whatever
+ * is still registered at shutdown is reported as a leak.
+ */
+#define GPU_MEM_TEXTURE 0
+#define GPU_MEM_BUFFER 1
+#define GPU_MEM_RENDER_TARGET 2
+#define GPU_MEM_KIND_COUNT 3
+
+const char *mem_tag_names[MEM_TAG_COUNT] = { "general", "world", "model", "texture", "render", "hud" };
+const char *gpu_mem_kind_names[GPU_MEM_KIND_COUNT] = { "texture", "buffer", "render target" };
+
+struct MemTagStats {
+	std::atomic<size_t> bytes;
+	std::atomic<size_t> peak;
+	std::atomic<size_t> allocations; /* total, including freed ones */
+	std::atomic<size_t> live;
+};
+
+static MemTagStats mem_stats[MEM_TAG_COUNT];
+
+/* in front of every tagged allocation, keeps the payload 16 byte aligned */
+struct alignas(16) MemHeader {
+	size_t size;
+	int tag;
+};
+
+void *mem_alloc(int tag, size_t size) {
+	MemHeader *header = (MemHeader *)malloc(sizeof(MemHeader) + size);
+	if (!header) {
+		die("Out of memory!");
+	}
+
+	header->size = size;
+	header->tag = tag;
+
+	MemTagStats *stats = &mem_stats[tag];
+	size_t bytes = stats->bytes.fetch_add(size, std::memory_order_relaxed) + size;
+	size_t peak = stats->peak.load(std::memory_order_relaxed);
+	while (bytes > peak && !stats->peak.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+	stats->allocations.fetch_add(1, std::memory_order_relaxed);
+	stats->live.fetch_add(1, std::memory_order_relaxed);
+
+	return header + 1;
+}
+
+void mem_free(void *ptr) {
+	if (!ptr) {
+		return;
+	}
+
+	MemHeader *header = (MemHeader *)ptr - 1;
+	MemTagStats *stats = &mem_stats[header->tag];
+	stats->bytes.fetch_sub(header->size, std::memory_order_relaxed);
+	stats->live.fetch_sub(1, std::memory_order_relaxed);
+
+	free(header);
+}
+
+void *mem_realloc(int tag, void *ptr, size_t size) {
+	void *result = mem_alloc(tag, size);
+
+	if (ptr) {
+		MemHeader *header = (MemHeader *)ptr - 1;
+		memcpy(result, ptr, std::min(header->size, size));
+		mem_free(ptr);
+	}
+
+	return result;
+}
+
+/* uninitialized storage for count plain values, release with mem_free */
+template <typename T>
+T *mem_alloc_array(int tag, size_t count) {
+	return (T *)mem_alloc(tag, sizeof(T) * count);
+}
+
+/* lets std containers allocate from a tag */
+template <typename T, int Tag>
+struct TaggedAllocator {
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind {
+		typedef TaggedAllocator<U, Tag> other;
+	};
+
+	TaggedAllocator() {}
+
+	template <typename U>
+	TaggedAllocator(const TaggedAllocator<U, Tag> &) {}
+
+	T *allocate(size_t count) {
+		return mem_alloc_array<T>(Tag, count);
+	}
+
+	void deallocate(T *ptr, size_t) {
+		mem_free(ptr);
+	}
+
+	template <typename U>
+	bool operator==(const TaggedAllocator<U, Tag> &) const { return true; }
+
+	template <typename U>
+	bool operator!=(const TaggedAllocator<U, Tag> &) const { return false; }
+};
+
+template <typename T, int Tag>
+using TaggedVector = std::vector<T, TaggedAllocator<T, Tag>>;
+
+/* frees a container's storage, clear() alone keeps the capacity */
+template <typename T, int Tag>
+void release(TaggedVector<T, Tag> &vector) {
+	TaggedVector<T, Tag>().swap(vector);
+}
+
+size_t cpu_memory_bytes(int tag) {
+	return mem_stats[tag].bytes.load(std::memory_order_relaxed);
+}
+
+size_t cpu_memory_total() {
+	size_t total = 0;
+	for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+		total += cpu_memory_bytes(tag);
+	}
+	return total;
+}
+
+struct GpuResource {
+	int kind;
+	GLuint name;
+	size_t bytes;
+	std::string label;
+};
+
+struct GpuMemory {
+	std::unordered_map<uint64_t, GpuResource> resources;
+	size_t bytes[GPU_MEM_KIND_COUNT];
+	size_t peak[GPU_MEM_KIND_COUNT];
+};
+
+static GpuMemory gpu_memory;
+
+uint64_t gpu_resource_key(int kind, GLuint name) {
+	return ((uint64_t)kind << 32) | name;
+}
+
+/* registers the storage of a GL object, calling it again for the same object replaces its size */
+void gpu_memory_track(int kind, GLuint name, size_t bytes, const char *label) {
+	GpuResource &resource = gpu_memory.resources[gpu_resource_key(kind, name)];
+
+	if (resource.bytes > 0) {
+		gpu_memory.bytes[resource.kind] -= resource.bytes;
+	}
+
+	resource.kind = kind;
+	resource.name = name;
+	resource.bytes = bytes;
+	resource.label = label;
+
+	gpu_memory.bytes[kind] += bytes;
+	gpu_memory.peak[kind] = std::max(gpu_memory.peak[kind], gpu_memory.bytes[kind]);
+}
+
+void gpu_memory_release(int kind, GLuint name) {
+	auto it = gpu_memory.resources.find(gpu_resource_key(kind, name));
+	if (it == gpu_memory.resources.end()) {
+		return;
+	}
+
+	gpu_memory.bytes[kind] -= it->second.bytes;
+	gpu_memory.resources.erase(it);
+}
+
+size_t gpu_memory_bytes(int kind) {
+	return gpu_memory.bytes[kind];
+}
+
+size_t gpu_memory_total() {
+	size_t total = 0;
+	for (int kind = 0; kind < GPU_MEM_KIND_COUNT; ++kind) {
+		total += gpu_memory.bytes[kind];
+	}
+	return total;
+}
+
+/* size of a full mip chain (or of levels of it) for uncompressed storage */
+size_t texture_storage_bytes(int width, int height, int layers, int bytes_per_texel, int levels) {
+	size_t bytes = 0;
+	for (int level = 0; level < levels; ++level) {
+		bytes += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1) * layers * bytes_per_texel;
+	}
+	return bytes;
+}
+
+void memory_report() {
+	for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+		MemTagStats *stats = &mem_stats[tag];
+		LOG(LOG_INFO, "CPU heap", log_str("tag", mem_tag_names[tag]), log_int("bytes", stats->bytes.load()),
+			log_int("peak", stats->peak.load()), log_int("allocations", stats->allocations.load()), log_int("live", stats->live.load()));
+	}
+
+	for (int kind = 0; kind < GPU_MEM_KIND_COUNT; ++kind) {
+		LOG(LOG_INFO, "GPU memory", log_str("kind", gpu_mem_kind_names[kind]), log_int("bytes", gpu_memory.bytes[kind]), log_int("peak", gpu_memory.peak[kind]));
+	}
+}
+
+/* logs everything still allocated, returns false if anything leaked */
+bool memory_leak_report() {
+	bool clean = true;
+
+	for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+		MemTagStats *stats = &mem_stats[tag];
+		if (stats->live.load() > 0) {
+			LOG(LOG_WARNING, "Leaked CPU memory", log_str("tag", mem_tag_names[tag]), log_int("bytes", stats->bytes.load()), log_int("allocations", stats->live.load()));
+			clean = false;
+		}
+	}
+
+	for (auto &entry : gpu_memory.resources) {
+		GpuResource *resource = &entry.second;
+		LOG(LOG_WARNING, "Leaked GPU resource", log_str("kind", gpu_mem_kind_names[resource->kind]), log_int("name", resource->name),
+			log_str("label", resource->label.c_str()), log_int("bytes", resource->bytes));
+		clean = false;
+	}
+
+	if (clean) {
+		LOG(LOG_INFO, "No memory leaks");
+	}
+
+	return clean;
+}
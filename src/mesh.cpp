@@ -0,0 +1,464 @@
+/*
+ * Baked meshes. The Bake tool imports a model once and writes it next to the
+ * source as a .mesh file: a header, interleaved vertices in the mesh's
+ * vertex format and its indices. Vertices and indices form one contiguous
+ * range, so loading is a single mmap and a single buffer upload
+ * straight out of the mapping. The header records the size and modification
+ * time of the source; if the source changed since, the bake has another
+ * format, or there is no bake, load_mesh imports the source instead.
+ *
+ * Vertex formats, chosen per mesh:
+ *   MESH_FORMAT_FLOAT      MeshVertex, 32 bytes of plain floats
+ *   MESH_FORMAT_QUANTIZED  PackedVertex, 16 bytes: half float position and
+ *                          uv, octahedral normal in two snorm shorts
+ * Indices are 16 bit whenever the vertex count allows, 32 bit otherwise.
+ * All levels of detail share the vertices, their index ranges follow each
+ * other in the index buffer, finest first.
+ */
+#define MESH_MAGIC 0x48534d50 /* "PMSH" */
+#define MESH_VERSION 3
+
+#define MESH_FORMAT_FLOAT 0
+#define MESH_FORMAT_QUANTIZED 1
+
+/* locations 3 to 8 hold the instance attributes */
+#define ATTRIB_OCTAHEDRAL_NORMAL 9
+
+const char *mesh_format_names[] = { "float", "quantized" };
+
+/* what shaders drawing a format are compiled with, they read its normals */
+const char *mesh_format_defines[] = { "", "#define MESH_QUANTIZED\n" };
+
+/* also the layout import and processing work on */
+struct MeshVertex {
+	glm::vec3 pos;
+	glm::vec2 uv;
+	glm::vec3 normal;
+};
+
+struct PackedVertex {
+	uint16_t pos[3]; /* half floats */
+	uint16_t pad;
+	uint16_t uv[2]; /* half floats */
+	int16_t normal[2]; /* octahedral, snorm */
+};
+
+static_assert(sizeof(PackedVertex) == 16, "packed vertices are 16 bytes");
+
+struct MeshHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t format;
+	uint32_t index_size; /* 2 or 4 bytes */
+	uint32_t vertex_count;
+	uint32_t index_count;
+	uint32_t vertex_offset; /* from the start of the file */
+	uint32_t index_offset;
+	glm::vec4 bounds; /* sphere, center and radius */
+	uint32_t lod_count;
+	MeshLod lods[MESH_MAX_LODS];
+};
+
+/* without lods, all indices are a single level */
+struct MeshData {
+	TaggedVector<MeshVertex, MEM_MODEL> vertices;
+	TaggedVector<uint32_t, MEM_MODEL> indices;
+	MeshLod lods[MESH_MAX_LODS];
+	int lod_count = 0;
+};
+
+/* a mesh in its GPU format, vertices followed by the indices */
+struct EncodedMesh {
+	int format;
+	unsigned int vertex_count;
+	unsigned int index_count;
+	GLenum index_type;
+	size_t index_offset;
+	glm::vec4 bounds;
+	MeshLod lods[MESH_MAX_LODS];
+	int lod_count;
+	TaggedVector<unsigned char, MEM_MODEL> data;
+};
+
+size_t mesh_vertex_stride(int format) {
+	return format == MESH_FORMAT_QUANTIZED ? sizeof(PackedVertex) : sizeof(MeshVertex);
+}
+
+size_t mesh_index_size(GLenum index_type) {
+	return index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+GLenum mesh_index_type(unsigned int vertex_count) {
+	return vertex_count <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+/* folds the lower hemisphere over the diagonals, decoded in vert.glsl */
+glm::vec2 octahedral_encode(glm::vec3 normal) {
+	normal /= glm::abs(normal.x) + glm::abs(normal.y) + glm::abs(normal.z);
+
+	glm::vec2 encoded(normal.x, normal.y);
+	if (normal.z < 0.0f) {
+		glm::vec2 sign(encoded.x >= 0.0f ? 1.0f : -1.0f, encoded.y >= 0.0f ? 1.0f : -1.0f);
+		encoded = (1.0f - glm::abs(glm::vec2(encoded.y, encoded.x))) * sign;
+	}
+
+	return encoded;
+}
+
+PackedVertex pack_vertex(const MeshVertex &vertex) {
+	PackedVertex packed;
+
+	for (int i = 0; i < 3; ++i) {
+		packed.pos[i] = glm::packHalf1x16(vertex.pos[i]);
+	}
+	packed.pad = 0;
+
+	packed.uv[0] = glm::packHalf1x16(vertex.uv.x);
+	packed.uv[1] = glm::packHalf1x16(vertex.uv.y);
+
+	glm::vec2 normal = octahedral_encode(vertex.normal);
+	packed.normal[0] = (int16_t)glm::packSnorm1x16(normal.x);
+	packed.normal[1] = (int16_t)glm::packSnorm1x16(normal.y);
+
+	return packed;
+}
+
+/* center of the bounding box and the distance to the farthest vertex from it */
+glm::vec4 mesh_bounds(const MeshData *mesh) {
+	if (mesh->vertices.empty()) {
+		return glm::vec4(0.0f);
+	}
+
+	glm::vec3 low = mesh->vertices[0].pos, high = low;
+	for (const MeshVertex &vertex : mesh->vertices) {
+		low = glm::min(low, vertex.pos);
+		high = glm::max(high, vertex.pos);
+	}
+
+	glm::vec3 center = (low + high) * 0.5f;
+	float radius = 0.0f;
+	for (const MeshVertex &vertex : mesh->vertices) {
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+
+	return glm::vec4(center, radius);
+}
+
+void encode_mesh(const MeshData *mesh, int format, EncodedMesh *encoded) {
+	encoded->format = format;
+	encoded->vertex_count = mesh->vertices.size();
+	encoded->index_count = mesh->indices.size();
+	encoded->index_type = mesh_index_type(encoded->vertex_count);
+	encoded->index_offset = mesh_vertex_stride(format) * encoded->vertex_count;
+	encoded->bounds = mesh_bounds(mesh);
+
+	if (mesh->lod_count > 0) {
+		memcpy(encoded->lods, mesh->lods, sizeof(MeshLod) * mesh->lod_count);
+		encoded->lod_count = mesh->lod_count;
+	} else {
+		encoded->lods[0] = { 0, encoded->index_count, 0.0f };
+		encoded->lod_count = 1;
+	}
+
+	encoded->data.resize(encoded->index_offset + mesh_index_size(encoded->index_type) * encoded->index_count);
+
+	unsigned char *vertices = encoded->data.data();
+	if (format == MESH_FORMAT_QUANTIZED) {
+		PackedVertex *packed = (PackedVertex *)vertices;
+		for (unsigned int i = 0; i < encoded->vertex_count; ++i) {
+			packed[i] = pack_vertex(mesh->vertices[i]);
+		}
+	} else {
+		memcpy(vertices, mesh->vertices.data(), encoded->index_offset);
+	}
+
+	unsigned char *indices = vertices + encoded->index_offset;
+	if (encoded->index_type == GL_UNSIGNED_SHORT) {
+		uint16_t *shorts = (uint16_t *)indices;
+		for (unsigned int i = 0; i < encoded->index_count; ++i) {
+			shorts[i] = mesh->indices[i];
+		}
+	} else {
+		memcpy(indices, mesh->indices.data(), sizeof(uint32_t) * encoded->index_count);
+	}
+}
+
+std::string baked_mesh_path(const char *source_path) {
+	return baked_path(source_path, ".mesh");
+}
+
+#ifdef PLATFORMER_USE_ASSIMP
+/* every mesh in the scene merges into one, like parse_obj does with objects */
+bool parse_mesh_assimp(const char *path, const VfsFile *file, MeshData *mesh) {
+	PROFILE_ZONE("parse_mesh_assimp");
+
+	/* the extension tells Assimp the format when it reads from memory */
+	const char *extension = strrchr(path, '.');
+	Assimp::Importer importer;
+	const aiScene *scene = importer.ReadFileFromMemory(file->data, file->size, aiProcess_GenSmoothNormals | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices,
+		extension ? extension + 1 : "");
+
+	if (!scene || scene->mNumMeshes == 0) {
+		LOG(LOG_ERROR, "No mesh in model", log_str("path", path));
+		return false;
+	}
+
+	aiVector3D zero_vector(0.0f);
+	mesh->vertices.clear();
+	mesh->indices.clear();
+
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+		aiMesh *source = scene->mMeshes[m];
+		uint32_t base = mesh->vertices.size();
+
+		for (unsigned int i = 0; i < source->mNumVertices; ++i) {
+			aiVector3D pos = source->mVertices[i];
+			aiVector3D uv = source->HasTextureCoords(0) ? source->mTextureCoords[0][i] : zero_vector;
+			aiVector3D normal = source->mNormals[i];
+
+			MeshVertex vertex;
+			vertex.pos = glm::vec3(pos.x, pos.y, pos.z);
+			vertex.uv = glm::vec2(uv.x, uv.y);
+			vertex.normal = glm::vec3(normal.x, normal.y, normal.z);
+			mesh->vertices.push_back(vertex);
+		}
+
+		for (unsigned int i = 0; i < source->mNumFaces; ++i) {
+			aiFace face = source->mFaces[i];
+			mesh->indices.push_back(base + face.mIndices[0]);
+			mesh->indices.push_back(base + face.mIndices[1]);
+			mesh->indices.push_back(base + face.mIndices[2]);
+		}
+	}
+
+	return true;
+}
+
+bool import_mesh_assimp(const char *path, MeshData *mesh) {
+	VfsFile file;
+	if (!vfs_open(path, &file)) {
+		LOG(LOG_ERROR, "Failed to open model", log_str("path", path));
+		return false;
+	}
+
+	bool ok = parse_mesh_assimp(path, &file, mesh);
+	vfs_close(&file);
+	return ok;
+}
+#endif
+
+/* OBJ is parsed natively, other formats need Assimp and so only import in the Bake tool */
+bool parse_mesh(const char *path, const VfsFile *file, MeshData *mesh) {
+	if (has_extension(path, ".obj")) {
+		return parse_obj(path, file, mesh);
+	}
+
+#ifdef PLATFORMER_USE_ASSIMP
+	return parse_mesh_assimp(path, file, mesh);
+#else
+	LOG(LOG_ERROR, "Only OBJ models load without a bake", log_str("path", path));
+	return false;
+#endif
+}
+
+bool import_mesh(const char *path, MeshData *mesh) {
+	PROFILE_ZONE("import_mesh");
+
+	VfsFile file;
+	if (!vfs_open(path, &file)) {
+		LOG(LOG_ERROR, "Failed to open model", log_str("path", path));
+		return false;
+	}
+
+	bool ok = parse_mesh(path, &file, mesh);
+	vfs_close(&file);
+	return ok;
+}
+
+bool write_mesh(const char *path, const EncodedMesh *mesh, uint64_t source_size, int64_t source_mtime) {
+	MeshHeader header = {};
+	header.magic = MESH_MAGIC;
+	header.version = MESH_VERSION;
+	header.source_size = source_size;
+	header.source_mtime = source_mtime;
+	header.format = mesh->format;
+	header.index_size = mesh_index_size(mesh->index_type);
+	header.vertex_count = mesh->vertex_count;
+	header.index_count = mesh->index_count;
+	header.vertex_offset = sizeof(MeshHeader);
+	header.index_offset = header.vertex_offset + mesh->index_offset;
+	header.bounds = mesh->bounds;
+	header.lod_count = mesh->lod_count;
+	memcpy(header.lods, mesh->lods, sizeof(MeshLod) * mesh->lod_count);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(mesh->data.data(), 1, mesh->data.size(), file);
+
+	return fclose(file) == 0;
+}
+
+/* the header if the file is a complete bake of the current format */
+const MeshHeader *mesh_header(const VfsFile *file) {
+	if (file->size < sizeof(MeshHeader)) {
+		return 0;
+	}
+
+	const MeshHeader *header = (const MeshHeader *)file->data;
+	if (header->magic != MESH_MAGIC || header->version != MESH_VERSION) {
+		return 0;
+	}
+
+	if (header->format > MESH_FORMAT_QUANTIZED || (header->index_size != 2 && header->index_size != 4)) {
+		return 0;
+	}
+
+	uint64_t vertex_end = header->vertex_offset + (uint64_t)mesh_vertex_stride(header->format) * header->vertex_count;
+	uint64_t index_end = header->index_offset + (uint64_t)header->index_size * header->index_count;
+	if (header->index_offset != vertex_end || index_end > file->size) {
+		return 0;
+	}
+
+	if (header->lod_count == 0 || header->lod_count > MESH_MAX_LODS) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < header->lod_count; ++i) {
+		if ((uint64_t)header->lods[i].first_index + header->lods[i].index_count > header->index_count) {
+			return 0;
+		}
+	}
+
+	return header;
+}
+
+bool mesh_is_stale(const MeshHeader *header, const char *source_path) {
+	return source_changed(source_path, header->source_size, header->source_mtime);
+}
+
+/*
+ * A mesh ready for upload: either a view into its mapped bake or a fresh
+ * encoding of the source. Preparing touches no GL state and may run on a
+ * worker thread, creating the model then only copies the bytes.
+ */
+struct PreparedMesh {
+	EncodedMesh encoded; /* data is empty when the bytes come from the bake */
+	VfsFile file;
+	const unsigned char *data; /* vertices followed by the indices */
+	size_t size;
+};
+
+/* takes over file, the bake of source_path, and closes it again when the bake is missing or unusable */
+bool prepare_baked_mesh(const char *source_path, int format, VfsFile *file, PreparedMesh *prepared) {
+	std::string baked_path = baked_mesh_path(source_path);
+	EncodedMesh *encoded = &prepared->encoded;
+	prepared->data = 0;
+	prepared->file = *file;
+	vfs_clear(file);
+
+	if (!prepared->file.data) {
+		return false;
+	}
+
+	const MeshHeader *header = mesh_header(&prepared->file);
+
+	if (!header) {
+		LOG(LOG_WARNING, "Ignoring invalid mesh bake", log_str("path", baked_path.c_str()));
+	} else if (mesh_is_stale(header, source_path)) {
+		LOG(LOG_WARNING, "Mesh bake is stale, run Bake", log_str("path", baked_path.c_str()));
+	} else if (header->format != (uint32_t)format) {
+		LOG(LOG_WARNING, "Mesh bake has another vertex format, run Bake", log_str("path", baked_path.c_str()), log_str("format", mesh_format_names[format]));
+	} else {
+		encoded->format = format;
+		encoded->vertex_count = header->vertex_count;
+		encoded->index_count = header->index_count;
+		encoded->index_type = header->index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		encoded->index_offset = header->index_offset - header->vertex_offset;
+		encoded->bounds = header->bounds;
+		memcpy(encoded->lods, header->lods, sizeof(MeshLod) * header->lod_count);
+		encoded->lod_count = header->lod_count;
+
+		prepared->data = prepared->file.data + header->vertex_offset;
+		prepared->size = encoded->index_offset + (size_t)header->index_size * header->index_count;
+		return true;
+	}
+
+	vfs_close(&prepared->file);
+	return false;
+}
+
+/* imports, optimizes and encodes the source in file, which is read here when null */
+bool prepare_source_mesh(const char *source_path, int format, const VfsFile *file, PreparedMesh *prepared) {
+	EncodedMesh *encoded = &prepared->encoded;
+	prepared->data = 0;
+
+	if (file && !file->data) {
+		LOG(LOG_ERROR, "Failed to open model", log_str("path", source_path));
+		return false;
+	}
+
+	MeshData mesh;
+	if (file ? !parse_mesh(source_path, file, &mesh) : !import_mesh(source_path, &mesh)) {
+		return false;
+	}
+	optimize_mesh(&mesh);
+	generate_lods(&mesh);
+
+	encode_mesh(&mesh, format, encoded);
+	prepared->data = encoded->data.data();
+	prepared->size = encoded->data.size();
+	return true;
+}
+
+bool prepare_mesh(const char *source_path, int format, PreparedMesh *prepared) {
+	PROFILE_ZONE("prepare_mesh");
+
+	VfsFile file;
+	if (vfs_open(baked_mesh_path(source_path).c_str(), &file) && prepare_baked_mesh(source_path, format, &file, prepared)) {
+		return true;
+	}
+
+	return prepare_source_mesh(source_path, format, nullptr, prepared);
+}
+
+void release_prepared_mesh(PreparedMesh *prepared) {
+	if (prepared->data && prepared->encoded.data.empty()) {
+		vfs_close(&prepared->file);
+	}
+	prepared->data = 0;
+	release(prepared->encoded.data);
+}
+
+/* uploads the prepared bytes, or only allocates the buffer when data is null */
+ComplexModel *create_mesh(const PreparedMesh *prepared, const void *data, const char *label) {
+	const EncodedMesh *encoded = &prepared->encoded;
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	ComplexModel *model = new ComplexModel(encoded->format, bytes, encoded->vertex_count, bytes ? bytes + encoded->index_offset : 0, encoded->index_count,
+		encoded->index_type, encoded->lods, encoded->lod_count, encoded->bounds);
+
+	gl_label(GL_VERTEX_ARRAY, model->vao, label);
+	gl_label(GL_BUFFER, model->buffer, label);
+
+	return model;
+}
+
+ComplexModel *load_mesh(const char *source_path, int format) {
+	PROFILE_ZONE("load_mesh");
+
+	PreparedMesh prepared;
+	if (!prepare_mesh(source_path, format, &prepared)) {
+		die("Failed to load mesh!");
+	}
+
+	ComplexModel *model = create_mesh(&prepared, prepared.data, source_path);
+	release_prepared_mesh(&prepared);
+
+	return model;
+}
@@ -0,0 +1,319 @@
+/*
+ * Index and vertex order optimization, run on every mesh before it is baked
+ * or uploaded:
+ *   1. triangles are reordered for the post-transform vertex cache with Tom
+ *      Forsyth's linear-speed algorithm (scores from a simulated LRU cache
+ *      and the number of triangles each vertex still has to serve),
+ *   2. the result is cut into clusters where the cache starts over, and the
+ *      clusters are sorted so outward facing ones draw first and occlude the
+ *      rest, which trades a little cache efficiency for less overdraw,
+ *   3. vertices are renumbered in first use order for fetch locality.
+ *
+ * ACMR is transformed vertices per triangle (0.5 is ideal for a regular
+ * grid, 3 is no reuse at all), ATVR transformed vertices per vertex (1 is
+ * ideal). Both are measured against a FIFO cache of MESH_ANALYZE_CACHE_SIZE.
+ */
+#define MESH_OPTIMIZE_CACHE_SIZE 32
+#define MESH_ANALYZE_CACHE_SIZE 16
+#define MESH_MAX_VALENCE_SCORE 32
+
+struct VertexCacheStats {
+	float acmr;
+	float atvr;
+};
+
+VertexCacheStats analyze_vertex_cache(const uint32_t *indices, size_t index_count, size_t vertex_count) {
+	uint32_t cache[MESH_ANALYZE_CACHE_SIZE];
+	int cache_head = 0;
+	int cache_used = 0;
+	size_t misses = 0;
+
+	for (size_t i = 0; i < index_count; ++i) {
+		uint32_t index = indices[i];
+
+		bool hit = false;
+		for (int c = 0; c < cache_used; ++c) {
+			if (cache[c] == index) {
+				hit = true;
+				break;
+			}
+		}
+
+		if (!hit) {
+			misses++;
+			cache[cache_head] = index;
+			cache_head = (cache_head + 1) % MESH_ANALYZE_CACHE_SIZE;
+			cache_used = std::min(cache_used + 1, MESH_ANALYZE_CACHE_SIZE);
+		}
+	}
+
+	VertexCacheStats stats;
+	stats.acmr = index_count ? (float)misses / (index_count / 3) : 0.0f;
+	stats.atvr = vertex_count ? (float)misses / vertex_count : 0.0f;
+	return stats;
+}
+
+struct ForsythScores {
+	float cache[MESH_OPTIMIZE_CACHE_SIZE];
+	float valence[MESH_MAX_VALENCE_SCORE];
+
+	ForsythScores() {
+		for (int i = 0; i < MESH_OPTIMIZE_CACHE_SIZE; ++i) {
+			/* the three vertices of the last triangle score the same, so it is not favored */
+			cache[i] = i < 3 ? 0.75f : powf(1.0f - (i - 3) / (float)(MESH_OPTIMIZE_CACHE_SIZE - 3), 1.5f);
+		}
+
+		valence[0] = 0.0f;
+		for (int i = 1; i < MESH_MAX_VALENCE_SCORE; ++i) {
+			/* vertices with few triangles left are finished off first */
+			valence[i] = 2.0f / sqrtf((float)i);
+		}
+	}
+
+	float vertex(int cache_position, unsigned int live_triangles) const {
+		if (live_triangles == 0) {
+			return -1.0f;
+		}
+
+		float score = cache_position >= 0 ? cache[cache_position] : 0.0f;
+		return score + valence[std::min(live_triangles, (unsigned int)MESH_MAX_VALENCE_SCORE - 1)];
+	}
+};
+
+static const ForsythScores forsyth_scores;
+
+void optimize_vertex_cache(uint32_t *indices, size_t index_count, size_t vertex_count) {
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+
+	/* the triangles around each vertex, the first live[v] of them still to be emitted */
+	TaggedVector<uint32_t, MEM_MODEL> offsets(vertex_count + 1, 0);
+	TaggedVector<uint32_t, MEM_MODEL> live(vertex_count, 0);
+	TaggedVector<uint32_t, MEM_MODEL> adjacency(index_count);
+
+	for (size_t i = 0; i < index_count; ++i) {
+		live[indices[i]]++;
+	}
+	for (size_t v = 0; v < vertex_count; ++v) {
+		offsets[v + 1] = offsets[v] + live[v];
+		live[v] = 0;
+	}
+	for (size_t i = 0; i < index_count; ++i) {
+		uint32_t v = indices[i];
+		adjacency[offsets[v] + live[v]++] = i / 3;
+	}
+
+	TaggedVector<int, MEM_MODEL> cache_position(vertex_count, -1);
+	TaggedVector<float, MEM_MODEL> vertex_score(vertex_count);
+	TaggedVector<float, MEM_MODEL> triangle_score(triangle_count, 0.0f);
+	TaggedVector<uint8_t, MEM_MODEL> emitted(triangle_count, 0);
+	TaggedVector<uint32_t, MEM_MODEL> output(index_count);
+
+	for (size_t v = 0; v < vertex_count; ++v) {
+		vertex_score[v] = forsyth_scores.vertex(-1, live[v]);
+	}
+	for (size_t t = 0; t < triangle_count; ++t) {
+		for (int k = 0; k < 3; ++k) {
+			triangle_score[t] += vertex_score[indices[t * 3 + k]];
+		}
+	}
+
+	/* three extra slots for the vertices pushed out by a new triangle */
+	uint32_t cache[MESH_OPTIMIZE_CACHE_SIZE + 3];
+	uint32_t next_cache[MESH_OPTIMIZE_CACHE_SIZE + 3];
+	int cache_size = 0;
+
+	size_t scan_cursor = 0;
+	int64_t best = 0;
+
+	for (size_t step = 0; step < triangle_count; ++step) {
+		if (best < 0) {
+			/* nothing in the cache has work left, continue with the next unemitted triangle */
+			while (emitted[scan_cursor]) {
+				scan_cursor++;
+			}
+			best = scan_cursor;
+		}
+
+		const uint32_t *triangle = &indices[best * 3];
+		memcpy(&output[step * 3], triangle, sizeof(uint32_t) * 3);
+		emitted[best] = 1;
+
+		int next_size = 0;
+		for (int k = 0; k < 3; ++k) {
+			uint32_t v = triangle[k];
+			next_cache[next_size++] = v;
+
+			/* take the triangle out of the vertex's live list */
+			uint32_t *list = &adjacency[offsets[v]];
+			for (uint32_t i = 0; i < live[v]; ++i) {
+				if (list[i] == best) {
+					list[i] = list[live[v] - 1];
+					break;
+				}
+			}
+			live[v]--;
+		}
+
+		for (int c = 0; c < cache_size; ++c) {
+			uint32_t v = cache[c];
+			if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+				next_cache[next_size++] = v;
+			}
+		}
+
+		memcpy(cache, next_cache, sizeof(uint32_t) * next_size);
+		cache_size = std::min(next_size, MESH_OPTIMIZE_CACHE_SIZE);
+
+		/* rescore everything that moved, including what just fell out */
+		best = -1;
+		float best_score = -1.0f;
+
+		for (int c = 0; c < next_size; ++c) {
+			uint32_t v = cache[c];
+			int position = c < MESH_OPTIMIZE_CACHE_SIZE ? c : -1;
+			cache_position[v] = position;
+
+			float score = forsyth_scores.vertex(position, live[v]);
+			float delta = score - vertex_score[v];
+			vertex_score[v] = score;
+
+			const uint32_t *list = &adjacency[offsets[v]];
+			for (uint32_t i = 0; i < live[v]; ++i) {
+				uint32_t t = list[i];
+				triangle_score[t] += delta;
+
+				if (position >= 0 && triangle_score[t] > best_score) {
+					best_score = triangle_score[t];
+					best = t;
+				}
+			}
+		}
+	}
+
+	memcpy(indices, output.data(), sizeof(uint32_t) * index_count);
+}
+
+struct MeshCluster {
+	uint32_t first; /* triangle */
+	uint32_t count;
+	float sort_key;
+};
+
+/* expects cache optimized indices, keeps clusters intact so most of the cache order survives */
+void optimize_overdraw(uint32_t *indices, size_t index_count, const MeshVertex *vertices) {
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+
+	TaggedVector<MeshCluster, MEM_MODEL> clusters;
+
+	/* a new cluster starts wherever a triangle shares nothing with the simulated cache */
+	uint32_t cache[MESH_ANALYZE_CACHE_SIZE];
+	int cache_head = 0;
+	int cache_used = 0;
+
+	for (size_t t = 0; t < triangle_count; ++t) {
+		int misses = 0;
+
+		for (int k = 0; k < 3; ++k) {
+			uint32_t index = indices[t * 3 + k];
+
+			bool hit = false;
+			for (int c = 0; c < cache_used; ++c) {
+				if (cache[c] == index) {
+					hit = true;
+					break;
+				}
+			}
+
+			if (!hit) {
+				misses++;
+				cache[cache_head] = index;
+				cache_head = (cache_head + 1) % MESH_ANALYZE_CACHE_SIZE;
+				cache_used = std::min(cache_used + 1, MESH_ANALYZE_CACHE_SIZE);
+			}
+		}
+
+		if (t == 0 || misses == 3) {
+			clusters.push_back({ (uint32_t)t, 0, 0.0f });
+		}
+		clusters.back().count++;
+	}
+
+	glm::vec3 mesh_center(0.0f);
+	float mesh_area = 0.0f;
+	TaggedVector<glm::vec4, MEM_MODEL> cluster_centers(clusters.size()); /* area weighted, w is the area */
+	TaggedVector<glm::vec3, MEM_MODEL> cluster_normals(clusters.size());
+
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		glm::vec3 center(0.0f), normal(0.0f);
+		float area = 0.0f;
+
+		for (uint32_t t = clusters[c].first; t < clusters[c].first + clusters[c].count; ++t) {
+			glm::vec3 a = vertices[indices[t * 3]].pos;
+			glm::vec3 b = vertices[indices[t * 3 + 1]].pos;
+			glm::vec3 d = vertices[indices[t * 3 + 2]].pos;
+
+			glm::vec3 face = glm::cross(b - a, d - a);
+			float face_area = glm::length(face);
+
+			center += (a + b + d) / 3.0f * face_area;
+			normal += face;
+			area += face_area;
+		}
+
+		mesh_center += center;
+		mesh_area += area;
+		cluster_centers[c] = glm::vec4(area > 0.0f ? center / area : center, area);
+		cluster_normals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal;
+	}
+
+	if (mesh_area > 0.0f) {
+		mesh_center /= mesh_area;
+	}
+
+	for (size_t c = 0; c < clusters.size(); ++c) {
+		clusters[c].sort_key = glm::dot(glm::vec3(cluster_centers[c]) - mesh_center, cluster_normals[c]);
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const MeshCluster &a, const MeshCluster &b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	TaggedVector<uint32_t, MEM_MODEL> output;
+	output.reserve(index_count);
+	for (const MeshCluster &cluster : clusters) {
+		output.insert(output.end(), indices + cluster.first * 3, indices + (cluster.first + cluster.count) * 3);
+	}
+
+	memcpy(indices, output.data(), sizeof(uint32_t) * index_count);
+}
+
+/* renumbers vertices in the order the indices first use them, drops unused ones */
+void optimize_vertex_fetch(MeshData *mesh) {
+	TaggedVector<uint32_t, MEM_MODEL> remap(mesh->vertices.size(), UINT32_MAX);
+	TaggedVector<MeshVertex, MEM_MODEL> vertices;
+	vertices.reserve(mesh->vertices.size());
+
+	for (uint32_t &index : mesh->indices) {
+		if (remap[index] == UINT32_MAX) {
+			remap[index] = vertices.size();
+			vertices.push_back(mesh->vertices[index]);
+		}
+		index = remap[index];
+	}
+
+	mesh->vertices.swap(vertices);
+}
+
+void optimize_mesh(MeshData *mesh) {
+	PROFILE_ZONE("optimize_mesh");
+
+	optimize_vertex_cache(mesh->indices.data(), mesh->indices.size(), mesh->vertices.size());
+	optimize_overdraw(mesh->indices.data(), mesh->indices.size(), mesh->vertices.data());
+	optimize_vertex_fetch(mesh);
+}
@@ -0,0 +1,293 @@
+/*
+ * Level of detail generation by quadric error edge collapse. Every vertex
+ * carries the area weighted quadric of the planes of its triangles; a
+ * collapse moves a vertex onto one of its neighbours and costs the mean
+ * squared distance of that point to both vertices' planes. Collapses run
+ * cheapest first in passes until the index count target is reached or the
+ * error limit is hit. Vertices only ever collapse onto existing vertices, so
+ * every level shares the mesh's vertex buffer. Vertices on open edges (mesh
+ * borders and uv or normal seams, where the index topology splits) stay in
+ * place, which keeps silhouettes and texture mapping intact.
+ */
+#define LOD_INDEX_RATIO 0.5f /* each level aims for this fraction of the previous one's triangles */
+#define LOD_MIN_REDUCTION 0.9f /* a level that cannot get below this fraction is not worth keeping */
+#define LOD_MAX_ERROR 0.1f /* relative to the mesh radius */
+
+struct Quadric {
+	double a2, ab, ac, ad;
+	double b2, bc, bd;
+	double c2, cd;
+	double d2;
+	double weight;
+};
+
+Quadric plane_quadric(glm::dvec3 normal, double d, double weight) {
+	Quadric q;
+	q.a2 = normal.x * normal.x * weight;
+	q.ab = normal.x * normal.y * weight;
+	q.ac = normal.x * normal.z * weight;
+	q.ad = normal.x * d * weight;
+	q.b2 = normal.y * normal.y * weight;
+	q.bc = normal.y * normal.z * weight;
+	q.bd = normal.y * d * weight;
+	q.c2 = normal.z * normal.z * weight;
+	q.cd = normal.z * d * weight;
+	q.d2 = d * d * weight;
+	q.weight = weight;
+	return q;
+}
+
+void add_quadric(Quadric *q, const Quadric &other) {
+	q->a2 += other.a2; q->ab += other.ab; q->ac += other.ac; q->ad += other.ad;
+	q->b2 += other.b2; q->bc += other.bc; q->bd += other.bd;
+	q->c2 += other.c2; q->cd += other.cd;
+	q->d2 += other.d2;
+	q->weight += other.weight;
+}
+
+/* mean squared distance of p to the planes in q */
+double quadric_error(const Quadric &q, glm::vec3 p) {
+	double x = p.x, y = p.y, z = p.z;
+	double error = q.a2 * x * x + 2 * q.ab * x * y + 2 * q.ac * x * z + 2 * q.ad * x +
+		q.b2 * y * y + 2 * q.bc * y * z + 2 * q.bd * y +
+		q.c2 * z * z + 2 * q.cd * z + q.d2;
+
+	return q.weight > 0.0 ? std::max(error, 0.0) / q.weight : 0.0;
+}
+
+struct Collapse {
+	uint32_t from;
+	uint32_t to;
+	float cost;
+};
+
+inline uint64_t edge_key(uint32_t a, uint32_t b) {
+	return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+/* marks vertices that touch an edge not shared by exactly two triangles */
+void find_locked_vertices(const uint32_t *indices, size_t index_count, TaggedVector<uint8_t, MEM_MODEL> *locked) {
+	TaggedVector<uint64_t, MEM_MODEL> edges(index_count);
+	for (size_t i = 0; i < index_count; i += 3) {
+		for (int k = 0; k < 3; ++k) {
+			edges[i + k] = edge_key(indices[i + k], indices[i + (k + 1) % 3]);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	std::fill(locked->begin(), locked->end(), 0);
+	for (size_t i = 0; i < edges.size();) {
+		size_t run = i + 1;
+		while (run < edges.size() && edges[run] == edges[i]) {
+			run++;
+		}
+
+		if (run - i != 2) {
+			(*locked)[edges[i] >> 32] = 1;
+			(*locked)[edges[i] & 0xffffffff] = 1;
+		}
+		i = run;
+	}
+}
+
+/* moving from onto to must not turn any remaining triangle around */
+bool collapse_keeps_orientation(const MeshVertex *vertices, const uint32_t *indices, const uint32_t *triangles, uint32_t triangle_count, uint32_t from, uint32_t to) {
+	for (uint32_t i = 0; i < triangle_count; ++i) {
+		const uint32_t *triangle = &indices[triangles[i] * 3];
+		if (triangle[0] == to || triangle[1] == to || triangle[2] == to) {
+			continue; /* collapses away */
+		}
+
+		glm::vec3 before[3], after[3];
+		for (int k = 0; k < 3; ++k) {
+			before[k] = vertices[triangle[k]].pos;
+			after[k] = triangle[k] == from ? vertices[to].pos : before[k];
+		}
+
+		glm::vec3 normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+		glm::vec3 normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+		if (glm::dot(normal_before, normal_after) <= 0.0f) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Simplifies indices towards target_index_count without moving any point
+ * further than max_error from the surface it came from. Returns the error
+ * reached, the indices of the result are in output.
+ */
+float simplify_indices(const MeshVertex *vertices, size_t vertex_count, const uint32_t *indices, size_t index_count,
+	size_t target_index_count, float max_error, TaggedVector<uint32_t, MEM_MODEL> *output) {
+	output->assign(indices, indices + index_count);
+
+	TaggedVector<Quadric, MEM_MODEL> quadrics(vertex_count, Quadric());
+	for (size_t i = 0; i < index_count; i += 3) {
+		glm::dvec3 a = vertices[indices[i]].pos, b = vertices[indices[i + 1]].pos, c = vertices[indices[i + 2]].pos;
+		glm::dvec3 normal = glm::cross(b - a, c - a);
+		double area = glm::length(normal);
+		if (area <= 0.0) {
+			continue;
+		}
+
+		normal /= area;
+		Quadric q = plane_quadric(normal, -glm::dot(normal, a), area);
+		for (int k = 0; k < 3; ++k) {
+			add_quadric(&quadrics[indices[i + k]], q);
+		}
+	}
+
+	TaggedVector<uint8_t, MEM_MODEL> locked(vertex_count);
+	TaggedVector<uint8_t, MEM_MODEL> touched(vertex_count);
+	TaggedVector<uint32_t, MEM_MODEL> remap(vertex_count);
+	TaggedVector<uint32_t, MEM_MODEL> offsets(vertex_count + 1);
+	TaggedVector<uint32_t, MEM_MODEL> adjacency;
+	TaggedVector<Collapse, MEM_MODEL> collapses;
+
+	double max_cost = (double)max_error * max_error;
+	double reached = 0.0;
+
+	while (output->size() > target_index_count) {
+		uint32_t *current = output->data();
+		size_t current_count = output->size();
+
+		find_locked_vertices(current, current_count, &locked);
+
+		/* triangles around each vertex */
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (size_t i = 0; i < current_count; ++i) {
+			offsets[current[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertex_count; ++v) {
+			offsets[v + 1] += offsets[v];
+		}
+		adjacency.resize(current_count);
+		TaggedVector<uint32_t, MEM_MODEL> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < current_count; ++i) {
+			adjacency[fill[current[i]]++] = i / 3;
+		}
+
+		collapses.clear();
+		for (size_t i = 0; i < current_count; i += 3) {
+			for (int k = 0; k < 3; ++k) {
+				uint32_t a = current[i + k], b = current[i + (k + 1) % 3];
+				uint32_t pairs[2][2] = { { a, b }, { b, a } };
+
+				for (auto &pair : pairs) {
+					uint32_t from = pair[0], to = pair[1];
+					if (locked[from]) {
+						continue;
+					}
+
+					Quadric q = quadrics[from];
+					add_quadric(&q, quadrics[to]);
+					collapses.push_back({ from, to, (float)quadric_error(q, vertices[to].pos) });
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) {
+			return a.cost < b.cost;
+		});
+
+		std::fill(touched.begin(), touched.end(), 0);
+		for (size_t v = 0; v < vertex_count; ++v) {
+			remap[v] = v;
+		}
+
+		size_t remaining = current_count;
+		size_t performed = 0;
+
+		for (const Collapse &collapse : collapses) {
+			if (remaining <= target_index_count || collapse.cost > max_cost) {
+				break;
+			}
+
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+
+			const uint32_t *triangles = &adjacency[offsets[collapse.from]];
+			uint32_t triangle_count = offsets[collapse.from + 1] - offsets[collapse.from];
+			if (!collapse_keeps_orientation(vertices, current, triangles, triangle_count, collapse.from, collapse.to)) {
+				continue;
+			}
+
+			/* the triangles around from change shape, so nothing else in them moves this pass */
+			for (uint32_t i = 0; i < triangle_count; ++i) {
+				const uint32_t *triangle = &current[triangles[i] * 3];
+				for (int k = 0; k < 3; ++k) {
+					touched[triangle[k]] = 1;
+				}
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) {
+					remaining -= 3;
+				}
+			}
+
+			remap[collapse.from] = collapse.to;
+			add_quadric(&quadrics[collapse.to], quadrics[collapse.from]);
+			reached = std::max(reached, (double)collapse.cost);
+			performed++;
+		}
+
+		if (performed == 0) {
+			break;
+		}
+
+		/* apply the pass, dropping the triangles that collapsed */
+		size_t write = 0;
+		for (size_t i = 0; i < current_count; i += 3) {
+			uint32_t a = remap[current[i]], b = remap[current[i + 1]], c = remap[current[i + 2]];
+			if (a != b && b != c && a != c) {
+				current[write++] = a;
+				current[write++] = b;
+				current[write++] = c;
+			}
+		}
+		output->resize(write);
+	}
+
+	return (float)sqrt(reached);
+}
+
+/*
+ * Appends coarser levels after the mesh's indices, each simplified from the
+ * one before and reordered for the vertex cache. Run after optimize_mesh,
+ * which only sees the finest level.
+ */
+void generate_lods(MeshData *mesh) {
+	PROFILE_ZONE("generate_lods");
+
+	uint32_t index_count = mesh->indices.size();
+	mesh->lods[0] = { 0, index_count, 0.0f };
+	mesh->lod_count = 1;
+
+	float radius = mesh_bounds(mesh).w;
+	TaggedVector<uint32_t, MEM_MODEL> simplified;
+
+	while (mesh->lod_count < MESH_MAX_LODS) {
+		MeshLod previous = mesh->lods[mesh->lod_count - 1];
+		size_t target = (size_t)(previous.index_count / 3 * LOD_INDEX_RATIO) * 3;
+
+		/* copied out, appending to mesh->indices may move them */
+		TaggedVector<uint32_t, MEM_MODEL> source(mesh->indices.begin() + previous.first_index, mesh->indices.begin() + previous.first_index + previous.index_count);
+		float error = simplify_indices(mesh->vertices.data(), mesh->vertices.size(), source.data(), source.size(), target, LOD_MAX_ERROR * radius, &simplified);
+
+		if (simplified.empty() || simplified.size() > previous.index_count * LOD_MIN_REDUCTION) {
+			break;
+		}
+
+		optimize_vertex_cache(simplified.data(), simplified.size(), mesh->vertices.size());
+
+		MeshLod lod;
+		lod.first_index = mesh->indices.size();
+		lod.index_count = simplified.size();
+		/* each level is simplified from the previous one, so the errors add up */
+		lod.error = previous.error + error;
+
+		mesh->indices.insert(mesh->indices.end(), simplified.begin(), simplified.end());
+		mesh->lods[mesh->lod_count++] = lod;
+	}
+}
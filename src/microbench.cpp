@@ -0,0 +1,430 @@
+/*
+ * Micro benchmarks for the simulation and loading hot paths, parameterized
+ * over world size and crate density. Every case is calibrated to a batch
+ * that runs for roughly MICROBENCH_SAMPLE_MS, warmed up, then sampled
+ * MICROBENCH_SAMPLES times; the table reports per call mean, stddev,
+ * min and median.
+ *
+ *   Microbench [--skip-gl] [--filter substring]
+ */
+#include <random>
+#include <algorithm>
+
+#define PLATFORMER_NO_MAIN
+#include "main.cpp"
+#include "worldgen.cpp"
+
+#define MICROBENCH_SAMPLE_MS 10.0
+#define MICROBENCH_WARMUP_SAMPLES 3
+#define MICROBENCH_SAMPLES 20
+
+static const char *bench_filter = 0;
+
+/* keeps the optimizer from dropping results */
+static volatile int bench_sink;
+
+struct BenchStats {
+	double mean_ns;
+	double stddev_ns;
+	double min_ns;
+	double median_ns;
+	long iterations;
+};
+
+template <typename F>
+BenchStats measure(F &&body) {
+	long batch = 1;
+
+	/* grow the batch until one sample is long enough to time reliably */
+	while (true) {
+		double start = platform_clock();
+		for (long i = 0; i < batch; ++i) body();
+		double elapsed_ms = (platform_clock() - start) * 1000.0;
+
+		if (elapsed_ms >= MICROBENCH_SAMPLE_MS || batch >= (1L << 30)) {
+			break;
+		}
+		batch = elapsed_ms <= 0.0 ? batch * 10 : std::max(batch * 2, (long)(batch * MICROBENCH_SAMPLE_MS / elapsed_ms));
+	}
+
+	std::vector<double> samples;
+	for (int s = 0; s < MICROBENCH_WARMUP_SAMPLES + MICROBENCH_SAMPLES; ++s) {
+		double start = platform_clock();
+		for (long i = 0; i < batch; ++i) body();
+		double per_call_ns = (platform_clock() - start) * 1e9 / batch;
+
+		if (s >= MICROBENCH_WARMUP_SAMPLES) {
+			samples.push_back(per_call_ns);
+		}
+	}
+
+	BenchStats stats;
+	stats.iterations = batch * MICROBENCH_SAMPLES;
+
+	double sum = 0.0;
+	for (double sample : samples) sum += sample;
+	stats.mean_ns = sum / samples.size();
+
+	double variance = 0.0;
+	for (double sample : samples) variance += (sample - stats.mean_ns) * (sample - stats.mean_ns);
+	stats.stddev_ns = sqrt(variance / (samples.size() - 1));
+
+	std::sort(samples.begin(), samples.end());
+	stats.min_ns = samples.front();
+	stats.median_ns = samples[samples.size() / 2];
+
+	return stats;
+}
+
+template <typename F>
+void bench(const char *name, const char *params, F &&body) {
+	char full_name[128];
+	snprintf(full_name, sizeof(full_name), "%s/%s", name, params);
+
+	if (bench_filter && !strstr(full_name, bench_filter)) {
+		return;
+	}
+
+	BenchStats stats = measure(body);
+	printf("%-40s %12.1f %10.1f %12.1f %12.1f %6.1f%% %12ld\n", full_name,
+		stats.mean_ns, stats.stddev_ns, stats.min_ns, stats.median_ns,
+		stats.mean_ns > 0.0 ? stats.stddev_ns / stats.mean_ns * 100.0 : 0.0, stats.iterations);
+}
+
+void write_world_file(World *world, const char *path, int size_x, int size_z) {
+	std::vector<std::string> lines(size_z, std::string(size_x, '0'));
+
+	for (const Block &block : world->blocks) {
+		char *cell = &lines[(int)block.z][(int)block.x];
+		if (block.y == 0 && *cell == '0') {
+			*cell = 'G';
+		} else if (block.y == 1) {
+			*cell = block.kind == ID_CRATE ? 'C' : 'Q';
+		}
+	}
+	lines[size_z / 2][size_x / 2] = 'X';
+
+	std::ofstream out(path);
+	for (const std::string &line : lines) {
+		out << line << "\n";
+	}
+}
+
+void bench_world(Platformer *platformer, int size, float density) {
+	World *world = &platformer->world;
+	Player *player = &platformer->player;
+	char params[64];
+	snprintf(params, sizeof(params), "%dx%d/%.2f", size, size, density);
+
+	generate_world(platformer, size, size, density, 7);
+
+	std::mt19937 random(11);
+	std::uniform_int_distribution<int> coord(-2, size + 1);
+	std::vector<glm::ivec3> queries(1024);
+	for (glm::ivec3 &query : queries) {
+		query = glm::ivec3(coord(random), random() % 2, coord(random));
+	}
+
+	size_t next = 0;
+	bench("has_block", params, [&]() {
+		glm::ivec3 q = queries[next++ & 1023];
+		bench_sink += world->has_block(q.x, q.y, q.z);
+	});
+
+	bench("Block::colliding", params, [&]() {
+		int hits = 0;
+		for (Block &block : world->blocks) {
+			hits += block.colliding(player);
+		}
+		bench_sink += hits;
+	});
+
+	std::vector<int> crates;
+	for (int i = 0; i < (int)world->blocks.size(); ++i) {
+		if (world->blocks[i].kind == ID_CRATE) {
+			crates.push_back(i);
+		}
+	}
+	if (!crates.empty()) {
+		next = 0;
+		bench("block_collisions", params, [&]() {
+			Block *block = &world->blocks[crates[next++ % crates.size()]];
+			bench_sink += block_collisions(world, block);
+		});
+	}
+
+	/* alternate directions so the player stays around the start */
+	int tick = 0;
+	bench("move", params, [&]() {
+		keys_down[GLFW_KEY_D] = (tick / 30) % 2 == 0;
+		keys_down[GLFW_KEY_A] = !keys_down[GLFW_KEY_D];
+		move(player, world);
+		tick++;
+	});
+	keys_down[GLFW_KEY_D] = false;
+	keys_down[GLFW_KEY_A] = false;
+
+	bench("reset_world", params, [&]() {
+		reset_world(world);
+	});
+
+	const char *path = "microbench_world.txt";
+	write_world_file(world, path, size, size);
+	bench("load_world", params, [&]() {
+		load_world(platformer, path);
+		bench_sink += world->blocks.size();
+	});
+	remove(path);
+}
+
+void bench_models() {
+	const char *models[] = { "cube", "crate", "player", "crab" };
+
+	for (const char *model : models) {
+		std::string path = std::string("resources/models/") + model + ".obj";
+		/* the baked fast path, or the OBJ import when there is no bake */
+		bench("load_mesh", model, [&]() {
+			delete load_mesh(path.c_str(), MESH_FORMAT_QUANTIZED);
+		});
+		bench("import_mesh", model, [&]() {
+			MeshData mesh;
+			import_mesh(path.c_str(), &mesh);
+			bench_sink += mesh.indices.size();
+		});
+
+		MeshData mesh;
+		import_mesh(path.c_str(), &mesh);
+		bench("optimize_mesh", model, [&]() {
+			MeshData copy = mesh;
+			optimize_mesh(&copy);
+			bench_sink += copy.indices[0];
+		});
+		bench("generate_lods", model, [&]() {
+			MeshData copy = mesh;
+			generate_lods(&copy);
+			bench_sink += copy.lod_count;
+		});
+		bench("encode_mesh quantized", model, [&]() {
+			EncodedMesh encoded;
+			encode_mesh(&mesh, MESH_FORMAT_QUANTIZED, &encoded);
+			bench_sink += encoded.data.size();
+		});
+	}
+}
+
+void bench_textures() {
+	const char *textures[] = { "cube", "water_texture" };
+
+	for (const char *texture : textures) {
+		std::string path = std::string("resources/textures/") + texture + ".png";
+		/* the baked levels, or decoding and glGenerateMipmap when there is no bake */
+		bench("load_texture", texture, [&]() {
+			delete_texture(load_texture(path.c_str()));
+		});
+
+		Image image;
+		if (!decode_image(path.c_str(), &image)) {
+			continue;
+		}
+
+		for (int format = TEXTURE_FORMAT_BC1; format <= TEXTURE_FORMAT_BC3; ++format) {
+			std::string name = std::string("encode_texture ") + texture_format_names[format];
+			bench(name.c_str(), texture, [&]() {
+				EncodedTexture encoded;
+				encode_texture(image.pixels, image.width, image.height, format, &encoded);
+				bench_sink += encoded.data.size();
+			});
+		}
+		free_image(&image);
+	}
+}
+
+/*
+ * Alternates between two levels' worth of meshes the way a level swap
+ * would: the next set is acquired before the last one is released, so the
+ * mesh both share stays loaded and only the others reload. Memory must
+ * come back to where it started, returns false when it did not.
+ */
+bool bench_resources() {
+	AssetLoader loader;
+	ResourceRegistry registry;
+	resource_registry_init(&registry, &loader);
+
+	const char *levels[2][2] = {
+		{ "resources/models/crab.obj", "resources/models/cube.obj" },
+		{ "resources/models/crab.obj", "resources/models/crate.obj" }
+	};
+
+	size_t cpu_before = cpu_memory_total();
+	size_t gpu_before = gpu_memory_bytes(GPU_MEM_BUFFER);
+
+	ResourceHandle current[2];
+	int level = 0;
+	bench("swap_level_resources", "meshes", [&]() {
+		level ^= 1;
+
+		ResourceHandle next[2];
+		for (int i = 0; i < 2; ++i) {
+			next[i] = acquire_mesh(&registry, levels[level][i], MESH_FORMAT_QUANTIZED, nullptr);
+		}
+		asset_loader_finish(&loader);
+
+		for (int i = 0; i < 2; ++i) {
+			if (!resource_ready(&registry, next[i])) {
+				die("Mesh not ready after asset_loader_finish!");
+			}
+			release_resource(&registry, &current[i]);
+			current[i] = next[i];
+		}
+		bench_sink += registry.live[RESOURCE_MESH];
+	});
+
+	for (ResourceHandle &handle : current) {
+		release_resource(&registry, &handle);
+	}
+
+	asset_loader_destroy(&loader);
+	jobs_shutdown();
+	async_io_shutdown();
+	resource_registry_destroy(&registry);
+
+	int64_t cpu_growth = (int64_t)cpu_memory_total() - (int64_t)cpu_before;
+	int64_t gpu_growth = (int64_t)gpu_memory_bytes(GPU_MEM_BUFFER) - (int64_t)gpu_before;
+	if (cpu_growth != 0 || gpu_growth != 0) {
+		LOG(LOG_ERROR, "Resource swaps leaked", log_int("cpu_growth", cpu_growth), log_int("gpu_growth", gpu_growth));
+		return false;
+	}
+
+	LOG(LOG_INFO, "Resource swaps done", log_int("cpu_growth", cpu_growth), log_int("gpu_growth", gpu_growth));
+	return true;
+}
+
+/* everything under resources read at once, the way streaming in a level would queue it */
+void bench_async_io() {
+	std::vector<std::string> paths;
+	list_files("resources", &paths);
+
+	const char *backends[] = { "io_uring", "pread" };
+	for (int backend = 0; backend < 2; ++backend) {
+		async_io.disable_uring = backend == 1;
+
+		bench("async_read resources", backends[backend], [&]() {
+			std::atomic<int> remaining(paths.size());
+			for (const std::string &path : paths) {
+				async_read(path.c_str(), [&remaining](IoBuffer *buffer) {
+					async_release(buffer);
+					remaining--;
+				});
+			}
+
+			while (remaining > 0) {
+				std::this_thread::yield();
+			}
+		});
+
+		/* the next backend starts with the next read */
+		jobs_shutdown();
+		async_io_shutdown();
+	}
+
+	async_io.disable_uring = false;
+}
+
+/*
+ * A message that fills a log record's text, followed by string fields the
+ * way gl_debug_callback logs a long driver message. The fields must come out
+ * empty without the copy running past the record.
+ */
+bool check_log_truncation() {
+	std::string message(LOG_TEXT_SIZE + 100, 'x');
+
+	LogRecord record;
+	record.text_used = 0;
+	log_copy_text(&record, message.c_str());
+	size_t source = log_copy_text(&record, "api");
+	size_t type = log_copy_text(&record, "error");
+
+	bool ok = record.text_used <= LOG_TEXT_SIZE && strlen(record.text) == LOG_TEXT_SIZE - 1 &&
+		source < LOG_TEXT_SIZE && type < LOG_TEXT_SIZE && record.text[source] == 0 && record.text[type] == 0;
+	if (!ok) {
+		LOG(LOG_ERROR, "Oversized log message overran its record", log_int("text_used", record.text_used));
+		return false;
+	}
+
+	LOG(LOG_DEBUG, message.c_str(), log_str("source", "api"), log_str("type", "error"));
+	return true;
+}
+
+/* a quad whose lines end in comments, as exporters write them */
+bool check_obj_comments() {
+	const char *source =
+		"# exported\n"
+		"v 0 0 0 # corner\n"
+		"v 1 0 0\t# corner\r\n"
+		"v 1 1 0#corner\n"
+		"v 0 1 0\n"
+		"vt 0 0 # uv\n"
+		"vn 0 0 1 # normal\n"
+		"f 1/1/1 2/1/1 3/1/1 4/1/1 # quad\n"
+		"f 1/1/1 3/1/1 4/1/1#\n";
+
+	VfsFile file;
+	vfs_clear(&file);
+	file.data = (const unsigned char *)source;
+	file.size = strlen(source);
+
+	MeshData mesh;
+	bool ok = parse_obj("comments.obj", &file, &mesh) && mesh.vertices.size() == 4 && mesh.indices.size() == 9 &&
+		mesh.vertices[2].pos == glm::vec3(1.0f, 1.0f, 0.0f) && mesh.vertices[0].normal == glm::vec3(0.0f, 0.0f, 1.0f);
+	if (!ok) {
+		LOG(LOG_ERROR, "Model with comments parsed wrong", log_int("vertices", mesh.vertices.size()), log_int("indices", mesh.indices.size()));
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv) {
+	bool skip_gl = false;
+	bool failed = false;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--skip-gl")) {
+			skip_gl = true;
+		} else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+			bench_filter = argv[++i];
+		} else {
+			std::cout << "usage: " << argv[0] << " [--skip-gl] [--filter substring]\n";
+			return EXIT_FAILURE;
+		}
+	}
+
+	failed |= !check_log_truncation();
+	failed |= !check_obj_comments();
+
+	printf("%-40s %12s %10s %12s %12s %7s %12s\n", "benchmark", "mean ns", "stddev", "min ns", "median ns", "cv", "iterations");
+
+	Platformer platformer;
+	global_platformer = &platformer;
+
+	const int sizes[] = { 16, 32, 64, 128 };
+	const float densities[] = { 0.05f, 0.2f, 0.5f };
+	for (int size : sizes) {
+		for (float density : densities) {
+			bench_world(&platformer, size, density);
+		}
+	}
+
+	bench_async_io();
+
+	/* model loading uploads to the GPU and needs a context */
+	if (!skip_gl) {
+		Platform *platform = create_platform(64, 64, true);
+		bench_models();
+		bench_textures();
+		failed |= !bench_resources();
+		destroy_platform(platform);
+	}
+
+	return failed ? EXIT_FAILURE : 0;
+}
@@ -1,202 +1,109 @@
-#define VB_VERT 0
-#define VB_UV 1
-#define VB_NORM 2
-#define VB_IND 3
+#define LOD_MAX_ERROR_PIXELS 1.0f
+#define LOD_MIN_DISTANCE 0.1f
 
 SimpleModel::SimpleModel(float *vertices, int num_vertices) {
 	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	gl_bind_vertex_array(vao);
 
 	vertices_count = num_vertices / 3;
 
 	glGenBuffers(1, &vbo);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * num_vertices, &vertices[0], GL_STATIC_DRAW);
+	gpu_memory_track(GPU_MEM_BUFFER, vbo, sizeof(float) * num_vertices, "simple model");
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 3, GL_FLOAT, 0, 0, 0);
 }
 
-void SimpleModel::render() {
-	glBindVertexArray(vao);
-	glDrawArrays(GL_TRIANGLES, 0, vertices_count);
+SimpleModel::~SimpleModel() {
+	gl_delete_vertex_array(vao);
+	gpu_memory_release(GPU_MEM_BUFFER, vbo);
+	glDeleteBuffers(1, &vbo);
 }
 
-ComplexModel::ComplexModel(float *vertices, int num_vertices, float *tex_coords, int num_tex_coords, float *normals, int num_normals, int *indices, int num_indices) {
+/*
+ * Uploads interleaved vertices in the given mesh format and their indices
+ * (every level of detail) into one buffer, indices after the vertices. When
+ * the two are already adjacent in memory, as in a mapped .mesh file, that is
+ * a single upload.
+ */
+ComplexModel::ComplexModel(int format, const void *vertices, unsigned int vertex_count, const void *indices, unsigned int index_count, GLenum _index_type,
+	const MeshLod *_lods, int _lod_count, glm::vec4 _bounds) {
 	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-
-	indices_count = num_indices;
-
-	glGenBuffers(4, vbos);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbos[VB_VERT]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * num_vertices, &vertices[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, 0, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbos[VB_UV]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * num_tex_coords, &tex_coords[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 2, GL_FLOAT, 0, 0, 0);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vbos[VB_NORM]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * num_normals, &normals[0], GL_STATIC_DRAW);
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 3, GL_FLOAT, 0, 0, 0);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbos[VB_IND]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(int) * num_indices, &indices[0], GL_STATIC_DRAW);
-}
-
-void ComplexModel::render() {
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, indices_count, GL_UNSIGNED_INT, 0);
-}
-
-ComplexModel *load_obj_file(const char *file) {
-	Assimp::Importer importer;
-
-	const aiScene *scene = importer.ReadFile(file, aiProcess_GenSmoothNormals | aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
-	
-	if (scene->mNumMeshes != 1) {
-		die("Illegal number of meshes in object file!");
+	gl_bind_vertex_array(vao);
+
+	lod_count = std::min(_lod_count, MESH_MAX_LODS);
+	memcpy(lods, _lods, sizeof(MeshLod) * lod_count);
+	bounds = _bounds;
+
+	indices_count = lods[0].index_count;
+	index_type = _index_type;
+	index_offset = mesh_vertex_stride(format) * vertex_count;
+
+	size_t index_bytes = mesh_index_size(index_type) * index_count;
+	size_t total_bytes = index_offset + index_bytes;
+	/* without vertices the buffer is only allocated, for a copy from a staging buffer */
+	bool contiguous = !vertices || (const unsigned char *)vertices + index_offset == indices;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, total_bytes, contiguous ? vertices : 0, GL_STATIC_DRAW);
+	if (!contiguous) {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, index_offset, vertices);
+		glBufferSubData(GL_ARRAY_BUFFER, index_offset, index_bytes, indices);
 	}
-
-	aiMesh *mesh = scene->mMeshes[0];
-
-	int num_vertices = mesh->mNumVertices * 3;
-	float *vertices = new float[num_vertices];
-
-	int num_tex_coords = mesh->mNumVertices * 2;
-	float *tex_coords = new float[num_tex_coords];
-
-	int num_normals = mesh->mNumVertices * 3;
-	float *normals = new float[num_normals];
-
-	int num_indices = mesh->mNumFaces * 3;
-	int *indices = new int[num_indices];
-
-	aiVector3D zero_vector(0.0f);
-	for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
-		aiVector3D pos = mesh->mVertices[i];
-		aiVector3D tex_coords = mesh->HasTextureCoords(0) ? mesh->mTextureCoords[0][i] : zero_vector;
-		aiVector3D normal = mesh->mNormals[i];
-
-		vertices[i * 3] = pos.x;
-		vertices[i * 3 + 1] = pos.y;
-		vertices[i * 3 + 2] = pos.z;
-
-		tex_coords[i * 2] = tex_coords.x;
-		tex_coords[i * 2 + 1] = tex_coords.y;
-
-		normals[i * 3] = normal.x;
-		normals[i * 3 + 1] = normal.y;
-		normals[i * 3 + 2] = normal.z;
+	gpu_memory_track(GPU_MEM_BUFFER, buffer, total_bytes, "mesh");
+
+	if (format == MESH_FORMAT_QUANTIZED) {
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, 0, sizeof(PackedVertex), (void *)offsetof(PackedVertex, pos));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_HALF_FLOAT, 0, sizeof(PackedVertex), (void *)offsetof(PackedVertex, uv));
+		/* shaders drawing this format are compiled with MESH_QUANTIZED and decode these */
+		glEnableVertexAttribArray(ATTRIB_OCTAHEDRAL_NORMAL);
+		glVertexAttribPointer(ATTRIB_OCTAHEDRAL_NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, normal));
+	} else {
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, 0, sizeof(MeshVertex), (void *)offsetof(MeshVertex, pos));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 2, GL_FLOAT, 0, sizeof(MeshVertex), (void *)offsetof(MeshVertex, uv));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, 0, sizeof(MeshVertex), (void *)offsetof(MeshVertex, normal));
 	}
 
-	for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
-		aiFace face = mesh->mFaces[i];
-		indices[i * 3] = face.mIndices[0];	
-		indices[i * 3 + 1] = face.mIndices[1];	
-		indices[i * 3 + 2] = face.mIndices[2];	
-	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
 
-	return new ComplexModel(vertices, num_vertices, tex_coords, num_tex_coords, normals, num_normals, indices, num_indices);
+ComplexModel::~ComplexModel() {
+	gl_delete_vertex_array(vao);
+	gpu_memory_release(GPU_MEM_BUFFER, buffer);
+	glDeleteBuffers(1, &buffer);
 }
-/*
-Model *load_obj_file(const char *file_name) {
-	std::vector<glm::fvec3> vertices;
-	std::vector<glm::fvec2> tex_coords;
-	std::vector<glm::fvec3> normals;
-
-	std::vector<int> face_vertices;
-	std::vector<int> face_tex_coords;
-	std::vector<int> face_normals;
-
-	std::stringstream ss;
-	std::ifstream in_file(file_name);
-	std::string line = "";
-	std::string prefix = "";
-	glm::vec3 temp_vec3;
-	glm::vec2 temp_vec2;
-	GLint temp_glint = 0;
-
-	if (!in_file.is_open()) {
-		die("Failed to open model!");
-	}
 
-	while (std::getline(in_file, line)) {
-		ss.clear();
-		ss.str(line);
-		ss >> prefix;
-
-		if (prefix == "v") {
-			ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-			vertices.push_back(temp_vec3);
-		} else if (prefix == "vt") {
-			ss >> temp_vec2.x >> temp_vec2.y;
-			tex_coords.push_back(temp_vec2);
-		} else if (prefix == "vn") {
-			ss >> temp_vec3.x >> temp_vec3.y >> temp_vec3.z;
-			normals.push_back(temp_vec3);
-		} else if (prefix == "f") {
-			int counter = 0;
-			while (ss >> temp_glint) {
-				if (counter == 0) {
-					int index = temp_glint - 1;
-					face_vertices.push_back(index);
-				} else if (counter == 1) {
-					int tex_index = temp_glint - 1;
-					face_tex_coords.push_back(tex_index);
-				} else if (counter == 2) {
-					int normal_index = temp_glint - 1;
-					face_normals.push_back(normal_index);
-				}
-
-				if (ss.peek() == '/') {
-					++counter;
-					ss.ignore(1, '/');
-				} else if (ss.peek() == ' ') {
-					++counter;
-					ss.ignore(1, ' ');
-				}
-
-				if (counter > 2)
-					counter = 0;
-			}
+/*
+ * Picks the coarsest level of detail whose simplification error still
+ * projects to at most LOD_MAX_ERROR_PIXELS, for an instance at model_matrix
+ * seen from eye. pixel_scale is the projected size in pixels of one unit at
+ * distance one (see lod_pixel_scale).
+ */
+int select_lod(const ComplexModel *model, const glm::mat4 &model_matrix, glm::vec3 eye, float pixel_scale) {
+	float scale = std::max(glm::length(glm::vec3(model_matrix[0])), std::max(glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2]))));
+	glm::vec3 center = glm::vec3(model_matrix * glm::vec4(glm::vec3(model->bounds), 1.0f));
+
+	/* to the nearest point of the bounding sphere, the camera may be inside it */
+	float distance = std::max(glm::length(center - eye) - model->bounds.w * scale, LOD_MIN_DISTANCE);
+
+	for (int lod = model->lod_count - 1; lod > 0; --lod) {
+		if (model->lods[lod].error * scale / distance * pixel_scale <= LOD_MAX_ERROR_PIXELS) {
+			return lod;
 		}
 	}
 
-	int vertices_count = face_vertices.size() * 3;
-	float *vertices_array = new float[vertices_count];
-
-	int tex_coord_count = face_tex_coords.size() * 2;
-	float *tex_coords_array = new float[tex_coord_count];
-
-	int normals_count = face_normals.size() * 3;
-	float *normals_array = new float[normals_count];
-
-	for (int i = 0; i < face_vertices.size(); ++i) {
-		glm::vec3 pos = vertices[face_vertices[i]];
-		vertices_array[i * 3] = pos.x;
-		vertices_array[i * 3 + 1] = pos.y;
-		vertices_array[i * 3 + 2] = pos.z;
-	}
-
-	for (int i = 0; i < face_tex_coords.size(); ++i) {
-		glm::vec2 pos = tex_coords[face_tex_coords[i]];
-		tex_coords_array[i * 2] = pos.x;
-		tex_coords_array[i * 2 + 1] = pos.y;
-	}
-
-	for (int i = 0; i < face_normals.size(); ++i) {
-		glm::vec3 pos = normals[face_normals[i]];
-		normals_array[i * 3] = pos.x;
-		normals_array[i * 3 + 1] = pos.y;
-		normals_array[i * 3 + 2] = pos.z;
-	}
+	return 0;
+}
 
-	return new Model(vertices_array, vertices_count,
-		tex_coords_array, tex_coord_count,
-		normals_array, normals_count);
-}*/
+void use_lod(DrawItem *item, const ComplexModel *model, int lod) {
+	item->lod = lod;
+	item->element_count = model->lods[lod].index_count;
+	item->index_offset = model->index_offset + mesh_index_size(model->index_type) * model->lods[lod].first_index;
+}
@@ -0,0 +1,385 @@
+/*
+ * Native Wavefront OBJ loader. The file is mapped and parsed in place with
+ * hand rolled number parsing; v, vt, vn and f are read, everything else is
+ * skipped, a # ends the tokens of any line and all objects merge into one mesh. Polygons are triangulated as
+ * fans and face corners sharing the same v/vt/vn triple become one vertex
+ * (in first use order, like Assimp's JoinIdenticalVertices). Corners without
+ * a normal get a smooth one, the normalized sum of the normals of the faces
+ * around their position.
+ */
+struct ObjCorner {
+	int pos;
+	int uv; /* -1 if absent */
+	int normal; /* -1 if absent */
+};
+
+bool operator==(const ObjCorner &a, const ObjCorner &b) {
+	return a.pos == b.pos && a.uv == b.uv && a.normal == b.normal;
+}
+
+/* open addressing table from corner to vertex index, slots hold index + 1 */
+struct ObjVertexTable {
+	TaggedVector<uint32_t, MEM_MODEL> slots;
+	TaggedVector<ObjCorner, MEM_MODEL> corners; /* per vertex */
+
+	static uint32_t hash(const ObjCorner &corner) {
+		uint32_t h = corner.pos * 0x9e3779b1u;
+		h ^= (corner.uv + 1) * 0x85ebca6bu + (h << 6) + (h >> 2);
+		h ^= (corner.normal + 1) * 0xc2b2ae35u + (h << 6) + (h >> 2);
+		return h;
+	}
+
+	void reserve(size_t vertex_count) {
+		size_t capacity = 64;
+		while (capacity < vertex_count * 2) {
+			capacity *= 2;
+		}
+
+		slots.assign(capacity, 0);
+		for (uint32_t i = 0; i < corners.size(); ++i) {
+			insert_slot(corners[i], i);
+		}
+	}
+
+	void insert_slot(const ObjCorner &corner, uint32_t index) {
+		size_t mask = slots.size() - 1;
+		size_t slot = hash(corner) & mask;
+		while (slots[slot]) {
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = index + 1;
+	}
+
+	/* the vertex for corner, created if it is new */
+	uint32_t find(const ObjCorner &corner, bool *created) {
+		size_t mask = slots.size() - 1;
+		size_t slot = hash(corner) & mask;
+
+		while (slots[slot]) {
+			uint32_t index = slots[slot] - 1;
+			if (corners[index] == corner) {
+				*created = false;
+				return index;
+			}
+			slot = (slot + 1) & mask;
+		}
+
+		uint32_t index = corners.size();
+		corners.push_back(corner);
+		slots[slot] = index + 1;
+		*created = true;
+
+		if (corners.size() * 2 > slots.size()) {
+			reserve(slots.size());
+		}
+
+		return index;
+	}
+};
+
+inline bool obj_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline void obj_skip_blanks(const char **cursor, const char *end) {
+	while (*cursor < end && obj_blank(**cursor)) {
+		++*cursor;
+	}
+}
+
+/* where the tokens of the line at cursor stop, at its newline or a comment */
+inline const char *obj_line_end(const char *cursor, const char *end) {
+	while (cursor < end && *cursor != '\n' && *cursor != '#') {
+		++cursor;
+	}
+	return cursor;
+}
+
+inline void obj_skip_line(const char **cursor, const char *end) {
+	const char *newline = (const char *)memchr(*cursor, '\n', end - *cursor);
+	*cursor = newline ? newline + 1 : end;
+}
+
+static const double obj_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* [-+]digits[.digits][e[-+]digits], exact for the short decimals exporters write */
+bool obj_parse_float(const char **cursor, const char *end, float *value) {
+	obj_skip_blanks(cursor, end);
+	const char *p = *cursor;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+
+	uint64_t mantissa = 0;
+	int exponent = 0;
+	int digits = 0;
+
+	for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+		if (mantissa < 1000000000000000000ull) {
+			mantissa = mantissa * 10 + (*p - '0');
+		} else {
+			++exponent;
+		}
+	}
+
+	if (p < end && *p == '.') {
+		++p;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits) {
+			if (mantissa < 1000000000000000000ull) {
+				mantissa = mantissa * 10 + (*p - '0');
+				--exponent;
+			}
+		}
+	}
+
+	if (digits == 0) {
+		return false;
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		++p;
+		bool negative_exponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negative_exponent = *p == '-';
+			++p;
+		}
+
+		int e = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+			e = std::min(e * 10 + (*p - '0'), 10000);
+		}
+		exponent += negative_exponent ? -e : e;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0) {
+		result = -exponent <= 22 ? result / obj_powers_of_ten[-exponent] : result * pow(10.0, exponent);
+	} else if (exponent > 0) {
+		result = exponent <= 22 ? result * obj_powers_of_ten[exponent] : result * pow(10.0, exponent);
+	}
+
+	*value = (float)(negative ? -result : result);
+	*cursor = p;
+	return true;
+}
+
+bool obj_parse_int(const char **cursor, const char *end, int *value) {
+	const char *p = *cursor;
+
+	bool negative = false;
+	if (p < end && *p == '-') {
+		negative = true;
+		++p;
+	}
+
+	if (p == end || *p < '0' || *p > '9') {
+		return false;
+	}
+
+	int result = 0;
+	for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+		result = result * 10 + (*p - '0');
+	}
+
+	*value = negative ? -result : result;
+	*cursor = p;
+	return true;
+}
+
+/* one based, negative indices count back from the last element */
+inline int obj_resolve_index(int index, size_t count) {
+	return index < 0 ? (int)count + index : index - 1;
+}
+
+bool obj_parse_corner(const char **cursor, const char *end, size_t positions, size_t uvs, size_t normals, ObjCorner *corner) {
+	int index;
+	if (!obj_parse_int(cursor, end, &index)) {
+		return false;
+	}
+
+	corner->pos = obj_resolve_index(index, positions);
+	corner->uv = -1;
+	corner->normal = -1;
+
+	if (*cursor < end && **cursor == '/') {
+		++*cursor;
+		if (obj_parse_int(cursor, end, &index)) {
+			corner->uv = obj_resolve_index(index, uvs);
+		}
+
+		if (*cursor < end && **cursor == '/') {
+			++*cursor;
+			if (!obj_parse_int(cursor, end, &index)) {
+				return false;
+			}
+			corner->normal = obj_resolve_index(index, normals);
+		}
+	}
+
+	return corner->pos >= 0 && corner->pos < (int)positions &&
+		corner->uv < (int)uvs && corner->uv >= -1 &&
+		corner->normal < (int)normals && corner->normal >= -1;
+}
+
+/* path only names the model in errors */
+bool parse_obj(const char *path, const VfsFile *file, MeshData *mesh) {
+	PROFILE_ZONE("parse_obj");
+
+	const char *begin = (const char *)file->data;
+	const char *end = begin + file->size;
+
+	/* count first so every array is allocated once */
+	size_t position_count = 0, uv_count = 0, normal_count = 0, face_count = 0;
+	for (const char *cursor = begin; cursor < end;) {
+		obj_skip_blanks(&cursor, end);
+		if (end - cursor >= 2 && cursor[0] == 'v') {
+			if (obj_blank(cursor[1])) position_count++;
+			else if (cursor[1] == 't') uv_count++;
+			else if (cursor[1] == 'n') normal_count++;
+		} else if (end - cursor >= 2 && cursor[0] == 'f' && obj_blank(cursor[1])) {
+			face_count++;
+		}
+		obj_skip_line(&cursor, end);
+	}
+
+	TaggedVector<glm::vec3, MEM_MODEL> positions;
+	TaggedVector<glm::vec2, MEM_MODEL> uvs;
+	TaggedVector<glm::vec3, MEM_MODEL> normals;
+	positions.reserve(position_count);
+	uvs.reserve(uv_count);
+	normals.reserve(normal_count);
+
+	ObjVertexTable table;
+	table.corners.reserve(face_count * 3);
+	table.reserve(face_count * 3);
+
+	mesh->vertices.clear();
+	mesh->indices.clear();
+	mesh->indices.reserve(face_count * 3);
+
+	bool missing_normals = false;
+	int line_number = 0;
+	bool ok = true;
+
+	for (const char *cursor = begin; cursor < end && ok; obj_skip_line(&cursor, end)) {
+		line_number++;
+		obj_skip_blanks(&cursor, end);
+
+		const char *line_end = obj_line_end(cursor, end);
+		if (line_end - cursor < 2) {
+			continue;
+		}
+
+		if (cursor[0] == 'v' && obj_blank(cursor[1])) {
+			cursor += 1;
+			glm::vec3 pos;
+			ok = obj_parse_float(&cursor, line_end, &pos.x) && obj_parse_float(&cursor, line_end, &pos.y) && obj_parse_float(&cursor, line_end, &pos.z);
+			positions.push_back(pos);
+		} else if (cursor[0] == 'v' && cursor[1] == 't') {
+			cursor += 2;
+			glm::vec2 uv;
+			ok = obj_parse_float(&cursor, line_end, &uv.x) && obj_parse_float(&cursor, line_end, &uv.y);
+			uvs.push_back(uv);
+		} else if (cursor[0] == 'v' && cursor[1] == 'n') {
+			cursor += 2;
+			glm::vec3 normal;
+			ok = obj_parse_float(&cursor, line_end, &normal.x) && obj_parse_float(&cursor, line_end, &normal.y) && obj_parse_float(&cursor, line_end, &normal.z);
+			normals.push_back(normal);
+		} else if (cursor[0] == 'f' && obj_blank(cursor[1])) {
+			cursor += 1;
+
+			uint32_t first = 0, previous = 0;
+			int corners = 0;
+
+			while (true) {
+				obj_skip_blanks(&cursor, line_end);
+				if (cursor == line_end) {
+					break;
+				}
+
+				ObjCorner corner;
+				if (!obj_parse_corner(&cursor, line_end, positions.size(), uvs.size(), normals.size(), &corner)) {
+					ok = false;
+					break;
+				}
+
+				bool created;
+				uint32_t vertex = table.find(corner, &created);
+				if (created) {
+					MeshVertex v;
+					v.pos = positions[corner.pos];
+					v.uv = corner.uv >= 0 ? uvs[corner.uv] : glm::vec2(0.0f);
+					v.normal = corner.normal >= 0 ? normals[corner.normal] : glm::vec3(0.0f);
+					missing_normals |= corner.normal < 0;
+					mesh->vertices.push_back(v);
+				}
+
+				if (corners == 0) {
+					first = vertex;
+				} else if (corners >= 2) {
+					mesh->indices.push_back(first);
+					mesh->indices.push_back(previous);
+					mesh->indices.push_back(vertex);
+				}
+
+				previous = vertex;
+				corners++;
+			}
+		}
+	}
+
+	if (!ok) {
+		LOG(LOG_ERROR, "Malformed model", log_str("path", path), log_int("line", line_number));
+		return false;
+	}
+
+	if (missing_normals) {
+		TaggedVector<glm::vec3, MEM_MODEL> smooth(positions.size(), glm::vec3(0.0f));
+
+		for (size_t i = 0; i < mesh->indices.size(); i += 3) {
+			const ObjCorner *c[3];
+			for (int k = 0; k < 3; ++k) {
+				c[k] = &table.corners[mesh->indices[i + k]];
+			}
+
+			glm::vec3 a = positions[c[0]->pos], b = positions[c[1]->pos], d = positions[c[2]->pos];
+			glm::vec3 face = glm::cross(b - a, d - a);
+			float length = glm::length(face);
+			if (length > 0.0f) {
+				face /= length;
+				for (int k = 0; k < 3; ++k) {
+					smooth[c[k]->pos] += face;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < mesh->vertices.size(); ++i) {
+			const ObjCorner &corner = table.corners[i];
+			if (corner.normal < 0) {
+				glm::vec3 normal = smooth[corner.pos];
+				float length = glm::length(normal);
+				mesh->vertices[i].normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+			}
+		}
+	}
+
+	return true;
+}
+
+bool load_obj(const char *path, MeshData *mesh) {
+	VfsFile file;
+	if (!vfs_open(path, &file)) {
+		LOG(LOG_ERROR, "Failed to open model", log_str("path", path));
+		return false;
+	}
+
+	bool ok = parse_obj(path, &file, mesh);
+	vfs_close(&file);
+	return ok;
+}
@@ -0,0 +1,461 @@
+/*
+ * Resource packs and the virtual file system every loader reads through.
+ *
+ * A pack is one file: a header, a directory of entries sorted by path, the
+ * paths themselves, then the entries' data, each starting on a
+ * PACK_ALIGNMENT boundary. Mounting maps the whole pack once; opening a
+ * stored entry afterwards is a pointer into the mapping, no syscall and no
+ * copy. Entries may be LZ4 compressed (the block format, no frames), those
+ * are decompressed into memory owned by the open file. The Bake tool writes
+ * packs and only compresses what shrinks noticeably; bakes stay stored so
+ * meshes and textures upload straight out of the mapping.
+ *
+ * vfs_open looks through the mounted packs, the last mounted first, and
+ * falls back to mapping the loose file. Mount before anything loads, the
+ * mount table is read from worker threads without a lock.
+ */
+#define PACK_MAGIC 0x4b415050 /* "PPAK" */
+#define PACK_VERSION 1
+#define PACK_ALIGNMENT 64
+#define PACK_DEFAULT_PATH "resources.pak" /* what the game mounts when it is there */
+
+#define PACK_STORED 0
+#define PACK_LZ4 1
+
+/* compressed entries must come out at most this fraction of their size */
+#define PACK_COMPRESS_RATIO 0.9
+
+#define VFS_MAX_PACKS 4
+
+struct PackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t names_size;
+	uint64_t data_offset; /* of the first entry */
+};
+
+struct PackEntry {
+	uint64_t offset; /* from the start of the pack */
+	uint64_t size; /* as stored */
+	uint64_t raw_size;
+	uint32_t name_offset; /* into the names after the directory */
+	uint16_t name_length;
+	uint16_t compression;
+};
+
+struct Pack {
+	MappedFile file;
+	const PackHeader *header;
+	const PackEntry *entries;
+	const char *names;
+};
+
+struct VfsFile {
+	const unsigned char *data;
+	size_t size;
+
+	MappedFile mapped; /* a loose file */
+	unsigned char *decompressed; /* a compressed entry, from mem_alloc */
+	IoBuffer *read; /* a loose file from vfs_open_async */
+};
+
+static Pack vfs_packs[VFS_MAX_PACKS];
+static int vfs_pack_count = 0;
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 /* the last bytes of a block are always literals */
+#define LZ4_MATCH_LIMIT 12 /* and no match starts this close to the end */
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 14
+
+size_t lz4_bound(size_t size) {
+	return size + size / 255 + 16;
+}
+
+inline uint32_t lz4_read32(const unsigned char *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/* 15 in the token nibble, the rest as 255s and a final byte */
+inline unsigned char *lz4_write_length(unsigned char *op, size_t length) {
+	for (length -= 15; length >= 255; length -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+/*
+ * Greedy compressor with a single hash table of the last position each four
+ * byte sequence was seen at. dst must hold lz4_bound(size) bytes, returns
+ * the compressed size.
+ */
+size_t lz4_compress(const unsigned char *src, size_t size, unsigned char *dst) {
+	TaggedVector<uint32_t, MEM_GENERAL> table(1 << LZ4_HASH_BITS, UINT32_MAX);
+
+	unsigned char *op = dst;
+	size_t anchor = 0;
+	size_t ip = 0;
+
+	while (size >= LZ4_MATCH_LIMIT + 1 && ip < size - LZ4_MATCH_LIMIT) {
+		uint32_t sequence = lz4_read32(src + ip);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+		uint32_t ref = table[hash];
+		table[hash] = ip;
+
+		if (ref == UINT32_MAX || ip - ref > LZ4_MAX_OFFSET || lz4_read32(src + ref) != sequence) {
+			ip++;
+			continue;
+		}
+
+		size_t length = LZ4_MIN_MATCH;
+		while (ip + length < size - LZ4_LAST_LITERALS && src[ref + length] == src[ip + length]) {
+			length++;
+		}
+
+		size_t literals = ip - anchor;
+		unsigned char *token = op++;
+		*token = (unsigned char)(std::min(literals, (size_t)15) << 4);
+		if (literals >= 15) {
+			op = lz4_write_length(op, literals);
+		}
+		memcpy(op, src + anchor, literals);
+		op += literals;
+
+		size_t offset = ip - ref;
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+
+		size_t match = length - LZ4_MIN_MATCH;
+		*token |= (unsigned char)std::min(match, (size_t)15);
+		if (match >= 15) {
+			op = lz4_write_length(op, match);
+		}
+
+		ip += length;
+		anchor = ip;
+	}
+
+	size_t literals = size - anchor;
+	*op++ = (unsigned char)(std::min(literals, (size_t)15) << 4);
+	if (literals >= 15) {
+		op = lz4_write_length(op, literals);
+	}
+	memcpy(op, src + anchor, literals);
+	op += literals;
+
+	return op - dst;
+}
+
+/* false on anything malformed, never reads or writes out of bounds */
+bool lz4_decompress(const unsigned char *src, size_t size, unsigned char *dst, size_t raw_size) {
+	size_t ip = 0, op = 0;
+
+	while (ip < size) {
+		unsigned char token = src[ip++];
+
+		size_t literals = token >> 4;
+		if (literals == 15) {
+			unsigned char byte;
+			do {
+				if (ip >= size) {
+					return false;
+				}
+				byte = src[ip++];
+				literals += byte;
+			} while (byte == 255);
+		}
+
+		if (literals > size - ip || literals > raw_size - op) {
+			return false;
+		}
+		memcpy(dst + op, src + ip, literals);
+		ip += literals;
+		op += literals;
+
+		/* the last sequence has no match */
+		if (ip == size) {
+			break;
+		}
+
+		if (size - ip < 2) {
+			return false;
+		}
+		size_t offset = src[ip] | (src[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op) {
+			return false;
+		}
+
+		size_t match = token & 15;
+		if (match == 15) {
+			unsigned char byte;
+			do {
+				if (ip >= size) {
+					return false;
+				}
+				byte = src[ip++];
+				match += byte;
+			} while (byte == 255);
+		}
+		match += LZ4_MIN_MATCH;
+
+		if (match > raw_size - op) {
+			return false;
+		}
+
+		/* byte by byte, the match may overlap what it writes */
+		for (size_t i = 0; i < match; ++i, ++op) {
+			dst[op] = dst[op - offset];
+		}
+	}
+
+	return op == raw_size;
+}
+
+/* the header if the mapped file is a complete pack */
+const PackHeader *pack_header(const MappedFile *file) {
+	if (file->size < sizeof(PackHeader)) {
+		return 0;
+	}
+
+	const PackHeader *header = (const PackHeader *)file->data;
+	if (header->magic != PACK_MAGIC || header->version != PACK_VERSION) {
+		return 0;
+	}
+
+	uint64_t names_end = sizeof(PackHeader) + (uint64_t)sizeof(PackEntry) * header->entry_count + header->names_size;
+	if (names_end > header->data_offset || header->data_offset > file->size) {
+		return 0;
+	}
+
+	const PackEntry *entries = (const PackEntry *)(header + 1);
+	for (uint32_t i = 0; i < header->entry_count; ++i) {
+		const PackEntry *entry = &entries[i];
+		if (entry->offset < header->data_offset || entry->offset + entry->size > file->size ||
+			(uint64_t)entry->name_offset + entry->name_length > header->names_size || entry->compression > PACK_LZ4) {
+			return 0;
+		}
+		if (entry->compression == PACK_STORED && entry->size != entry->raw_size) {
+			return 0;
+		}
+	}
+
+	return header;
+}
+
+/* the entry's path is not null terminated */
+int pack_compare(const Pack *pack, const PackEntry *entry, const char *path, size_t length) {
+	int order = memcmp(pack->names + entry->name_offset, path, std::min((size_t)entry->name_length, length));
+	if (order != 0) {
+		return order;
+	}
+	return (int)entry->name_length - (int)length;
+}
+
+const PackEntry *pack_find(const Pack *pack, const char *path) {
+	size_t length = strlen(path);
+	uint32_t low = 0, high = pack->header->entry_count;
+
+	while (low < high) {
+		uint32_t middle = (low + high) / 2;
+		int order = pack_compare(pack, &pack->entries[middle], path, length);
+		if (order == 0) {
+			return &pack->entries[middle];
+		}
+		if (order < 0) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+
+	return 0;
+}
+
+bool vfs_mount(const char *pack_path) {
+	if (vfs_pack_count == VFS_MAX_PACKS) {
+		LOG(LOG_ERROR, "Too many packs mounted", log_str("path", pack_path));
+		return false;
+	}
+
+	Pack *pack = &vfs_packs[vfs_pack_count];
+	if (!map_file(&pack->file, pack_path)) {
+		return false;
+	}
+
+	pack->header = pack_header(&pack->file);
+	if (!pack->header) {
+		LOG(LOG_ERROR, "Invalid pack", log_str("path", pack_path));
+		unmap_file(&pack->file);
+		return false;
+	}
+
+	pack->entries = (const PackEntry *)(pack->header + 1);
+	pack->names = (const char *)(pack->entries + pack->header->entry_count);
+	vfs_pack_count++;
+
+	LOG(LOG_INFO, "Mounted pack", log_str("path", pack_path), log_int("entries", pack->header->entry_count), log_int("bytes", pack->file.size));
+	return true;
+}
+
+void vfs_unmount_all() {
+	for (int i = 0; i < vfs_pack_count; ++i) {
+		unmap_file(&vfs_packs[i].file);
+	}
+	vfs_pack_count = 0;
+}
+
+void vfs_clear(VfsFile *file) {
+	file->data = 0;
+	file->size = 0;
+	file->mapped.data = 0;
+	file->mapped.size = 0;
+	file->decompressed = 0;
+	file->read = 0;
+}
+
+bool vfs_in_pack(const char *path) {
+	for (int i = 0; i < vfs_pack_count; ++i) {
+		if (pack_find(&vfs_packs[i], path)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* the contents of path, from a mounted pack or the loose file; safe on any thread */
+bool vfs_open(const char *path, VfsFile *file) {
+	vfs_clear(file);
+
+	for (int i = vfs_pack_count - 1; i >= 0; --i) {
+		const Pack *pack = &vfs_packs[i];
+		const PackEntry *entry = pack_find(pack, path);
+		if (!entry) {
+			continue;
+		}
+
+		const unsigned char *stored = pack->file.data + entry->offset;
+		if (entry->compression == PACK_STORED) {
+			file->data = stored;
+			file->size = entry->size;
+			return true;
+		}
+
+		file->decompressed = (unsigned char *)mem_alloc(MEM_GENERAL, std::max(entry->raw_size, (uint64_t)1));
+		if (!lz4_decompress(stored, entry->size, file->decompressed, entry->raw_size)) {
+			LOG(LOG_ERROR, "Corrupt pack entry", log_str("path", path));
+			mem_free(file->decompressed);
+			file->decompressed = 0;
+			return false;
+		}
+
+		file->data = file->decompressed;
+		file->size = entry->raw_size;
+		return true;
+	}
+
+	if (!map_file(&file->mapped, path)) {
+		return false;
+	}
+
+	file->data = file->mapped.data;
+	file->size = file->mapped.size;
+	return true;
+}
+
+void vfs_close(VfsFile *file) {
+	unmap_file(&file->mapped);
+	mem_free(file->decompressed);
+	async_release(file->read);
+	vfs_clear(file);
+}
+
+/* packs the files at paths under their paths, returns false if one cannot be read or the pack written */
+bool write_pack(const char *pack_path, std::vector<std::string> paths) {
+	std::sort(paths.begin(), paths.end());
+
+	PackHeader header = {};
+	header.magic = PACK_MAGIC;
+	header.version = PACK_VERSION;
+	header.entry_count = paths.size();
+
+	std::vector<PackEntry> entries(paths.size());
+	std::string names;
+	for (size_t i = 0; i < paths.size(); ++i) {
+		entries[i].name_offset = names.size();
+		entries[i].name_length = paths[i].size();
+		names += paths[i];
+	}
+	header.names_size = names.size();
+
+	uint64_t offset = sizeof(PackHeader) + sizeof(PackEntry) * entries.size() + names.size();
+	offset = (offset + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+	header.data_offset = offset;
+
+	/* every entry's data as it will be stored */
+	std::vector<TaggedVector<unsigned char, MEM_GENERAL>> data(paths.size());
+	uint64_t raw_total = 0;
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		PackEntry *entry = &entries[i];
+		entry->compression = PACK_STORED;
+		entry->offset = offset;
+
+		MappedFile file;
+		if (!map_file(&file, paths[i].c_str())) {
+			LOG(LOG_ERROR, "Failed to read file to pack", log_str("path", paths[i].c_str()));
+			return false;
+		}
+
+		/* an empty file maps to no data, it is packed as an empty entry */
+		if (file.size == 0) {
+			continue;
+		}
+
+		entry->raw_size = file.size;
+		raw_total += file.size;
+
+		/* bakes are uploaded straight out of the mapping, so they stay stored */
+		bool baked = has_extension(paths[i].c_str(), ".mesh") || has_extension(paths[i].c_str(), ".tex");
+		if (!baked) {
+			data[i].resize(lz4_bound(file.size));
+			size_t compressed = lz4_compress(file.data, file.size, data[i].data());
+			if (compressed <= file.size * PACK_COMPRESS_RATIO) {
+				data[i].resize(compressed);
+				entry->compression = PACK_LZ4;
+			}
+		}
+
+		if (entry->compression == PACK_STORED) {
+			data[i].assign(file.data, file.data + file.size);
+		}
+		unmap_file(&file);
+
+		entry->size = data[i].size();
+		offset = (offset + entry->size + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+	}
+
+	FILE *out = fopen(pack_path, "wb");
+	if (!out) {
+		return false;
+	}
+
+	static const unsigned char padding[PACK_ALIGNMENT] = {};
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(entries.data(), sizeof(PackEntry), entries.size(), out);
+	fwrite(names.data(), 1, names.size(), out);
+	fwrite(padding, 1, header.data_offset - ftell(out), out);
+
+	for (size_t i = 0; i < entries.size(); ++i) {
+		fwrite(data[i].data(), 1, data[i].size(), out);
+		uint64_t end = entries[i].offset + entries[i].size;
+		fwrite(padding, 1, (PACK_ALIGNMENT - end % PACK_ALIGNMENT) % PACK_ALIGNMENT, out);
+	}
+
+	LOG(LOG_INFO, "Wrote pack", log_str("path", pack_path), log_int("entries", entries.size()), log_int("raw_bytes", raw_total), log_int("bytes", ftell(out)));
+	return fclose(out) == 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * Window and GL context creation. The default backend is a GLFW window, the
+ * headless backend (Linux only) creates an EGL context without any surface
+ * and renders into an FBO that stands in for the window's back buffer, so the
+ * full renderer runs on machines without a display, e.g. on Mesa llvmpipe.
+ */
+struct Platform {
+	bool headless;
+	int width;
+	int height;
+
+	GLFWwindow *window;
+
+#ifdef __linux__
+	EGLDisplay display;
+	EGLContext context;
+	EGLSurface surface;
+#endif
+
+	/* frame buffer the finished frame is presented to, 0 for a window */
+	GLuint back_buffer;
+	GLuint back_buffer_color;
+
+	/* headless runs advance a fixed 1/60s per frame so they are reproducible */
+	bool fixed_timestep;
+	unsigned int frames;
+	int frame_limit;
+};
+
+void frame_buffer_resize(GLFWwindow *window, int nwidth, int nheight);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
+
+void init_glew(bool headless) {
+	glewExperimental = GL_TRUE;
+	GLenum result = glewInit();
+
+	/* without an X display GLEW fails on GLX after the GL entry points are loaded */
+	if (result != GLEW_OK && !(headless && result == GLEW_ERROR_NO_GLX_DISPLAY)) {
+		die("Failed to initialize GLEW!");
+	}
+
+	/* a core context reports GL_INVALID_ENUM from glewInit, drop it */
+	glGetError();
+
+	if (!GLEW_ARB_buffer_storage) {
+		die("GL_ARB_buffer_storage is not supported!");
+	}
+
+	gl_state_invalidate();
+	gl_debug_init();
+}
+
+void create_window(Platform *platform) {
+	if (!glfwInit()) {
+		die("Failed to initialize GLFW!");
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+#ifdef PLATFORMER_GL_DEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
+
+	GLFWwindow *window = glfwCreateWindow(platform->width, platform->height, "Platformer", 0, 0);
+
+	if (!window) {
+		die("Failed to create window!");
+	}
+
+	glfwMakeContextCurrent(window);
+
+	// vsync
+	// glfwSwapInterval(1);
+
+	init_glew(false);
+
+	glfwSetFramebufferSizeCallback(window, frame_buffer_resize);
+	glfwSetKeyCallback(window, key_callback);
+
+	glfwShowWindow(window);
+
+	glfwGetFramebufferSize(window, &platform->width, &platform->height);
+	platform->window = window;
+	platform->back_buffer = 0;
+}
+
+#ifdef __linux__
+void create_headless_context(Platform *platform) {
+	EGLDisplay display = EGL_NO_DISPLAY;
+
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display) {
+		display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0)) {
+		die("Failed to initialize EGL!");
+	}
+
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		die("EGL does not support desktop OpenGL!");
+	}
+
+	const EGLint config_attribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint num_configs = 0;
+	if (!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+		die("No suitable EGL config!");
+	}
+
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 4,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+#ifdef PLATFORMER_GL_DEBUG
+		EGL_CONTEXT_FLAGS_KHR, EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR,
+#endif
+		EGL_NONE
+	};
+
+	EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+	if (context == EGL_NO_CONTEXT) {
+		die("Failed to create EGL context!");
+	}
+
+	/* the surface is never drawn to, it only exists where surfaceless contexts don't */
+	EGLSurface surface = EGL_NO_SURFACE;
+	const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+	if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+		const EGLint pbuffer_attribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbuffer_attribs);
+	}
+
+	if (!eglMakeCurrent(display, surface, surface, context)) {
+		die("Failed to make EGL context current!");
+	}
+
+	init_glew(true);
+
+	glGenRenderbuffers(1, &platform->back_buffer_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, platform->back_buffer_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, platform->width, platform->height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	gpu_memory_track(GPU_MEM_RENDER_TARGET, platform->back_buffer_color, (size_t)platform->width * platform->height * 4, "back buffer");
+
+	glGenFramebuffers(1, &platform->back_buffer);
+	gl_bind_framebuffer(platform->back_buffer);
+	gl_label(GL_FRAMEBUFFER, platform->back_buffer, "headless back buffer");
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, platform->back_buffer_color);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		die("Headless back buffer is incomplete!");
+	}
+
+	platform->display = display;
+	platform->context = context;
+	platform->surface = surface;
+	platform->window = 0;
+}
+#endif
+
+Platform *create_platform(int width, int height, bool headless) {
+	Platform *platform = new Platform();
+	platform->headless = headless;
+	platform->width = width;
+	platform->height = height;
+	platform->fixed_timestep = headless;
+	platform->frames = 0;
+	platform->frame_limit = -1;
+
+	if (headless) {
+#ifdef __linux__
+		create_headless_context(platform);
+#else
+		die("Headless rendering is only supported on Linux!");
+#endif
+	} else {
+		create_window(platform);
+	}
+
+	return platform;
+}
+
+double platform_time(Platform *platform) {
+	if (platform->fixed_timestep) {
+		return platform->frames / 60.0;
+	}
+
+	return glfwGetTime();
+}
+
+/* wall clock in seconds, unaffected by the fixed timestep */
+double platform_clock() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* resident set size of the process in bytes, 0 where unknown */
+size_t platform_memory_usage() {
+#if defined(__linux__)
+	long pages = 0, resident = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (!statm) {
+		return 0;
+	}
+	if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(statm);
+	return (size_t)resident * sysconf(_SC_PAGESIZE);
+#elif defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.WorkingSetSize;
+#else
+	return 0;
+#endif
+}
+
+bool platform_should_close(Platform *platform) {
+	if (platform->frame_limit >= 0 && platform->frames >= (unsigned int)platform->frame_limit) {
+		return true;
+	}
+
+	return platform->window && glfwWindowShouldClose(platform->window);
+}
+
+void platform_swap(Platform *platform) {
+	PROFILE_ZONE("swap buffers");
+
+	platform->frames++;
+
+	if (platform->window) {
+		glfwSwapBuffers(platform->window);
+		glfwPollEvents();
+	} else {
+		/* nothing is displayed, keep the CPU from running ahead of the GPU */
+		glFlush();
+	}
+}
+
+/* writes the presented frame as a binary PPM */
+bool platform_save_screenshot(Platform *platform, const char *path) {
+	int w = platform->width;
+	int h = platform->height;
+	std::vector<unsigned char> pixels(w * h * 3);
+
+	gl_bind_framebuffer(platform->back_buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	fprintf(file, "P6\n%d %d\n255\n", w, h);
+	for (int y = h - 1; y >= 0; --y) {
+		fwrite(&pixels[y * w * 3], 1, w * 3, file);
+	}
+	fclose(file);
+
+	return true;
+}
+
+void destroy_platform(Platform *platform) {
+	if (platform->window) {
+		glfwTerminate();
+	}
+
+#ifdef __linux__
+	if (platform->headless) {
+		gpu_memory_release(GPU_MEM_RENDER_TARGET, platform->back_buffer_color);
+		glDeleteRenderbuffers(1, &platform->back_buffer_color);
+		gl_delete_framebuffer(platform->back_buffer);
+
+		eglMakeCurrent(platform->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(platform->display, platform->context);
+		if (platform->surface != EGL_NO_SURFACE) {
+			eglDestroySurface(platform->display, platform->surface);
+		}
+		eglTerminate(platform->display);
+	}
+#endif
+
+	delete platform;
+}
@@ -2,6 +2,18 @@ bool checkOpenGLError();
 std::string read_file(const char *file_path);
 float to_radians(float degrees);
 
+#define MEM_GENERAL 0
+#define MEM_WORLD 1
+#define MEM_MODEL 2
+#define MEM_TEXTURE 3
+#define MEM_RENDER 4
+#define MEM_HUD 5
+#define MEM_TAG_COUNT 6
+
+void *mem_alloc(int tag, size_t size);
+void *mem_realloc(int tag, void *ptr, size_t size);
+void mem_free(void *ptr);
+
 struct SimpleModel {
 	GLuint vao;
 	GLuint vbo;
@@ -9,21 +21,65 @@ struct SimpleModel {
 	unsigned int vertices_count;
 
 	SimpleModel(float *vertices, int num_vertices);
+	~SimpleModel();
+};
+
+#define MESH_MAX_LODS 4
 
-	void render();
+struct MeshLod {
+	uint32_t first_index;
+	uint32_t index_count;
+	float error; /* largest deviation from the full mesh, in model units */
 };
 
 struct ComplexModel {
 	GLuint vao;
-	GLuint vbos[4]; /* vertices, uv coords, normals */
+	GLuint buffer; /* interleaved vertices followed by the indices */
 
-	unsigned int indices_count;
+	unsigned int indices_count; /* of the finest level */
+	GLenum index_type;
+	size_t index_offset;
 
-	ComplexModel(float *vertices, int num_vertices, float *tex_coords, int num_tex_coords, float *normals, int num_normals, int *indices, int num_indices);
+	MeshLod lods[MESH_MAX_LODS];
+	int lod_count;
+	glm::vec4 bounds; /* sphere, center and radius */
 
-	void render();
+	ComplexModel(int format, const void *vertices, unsigned int vertex_count, const void *indices, unsigned int index_count, GLenum _index_type,
+		const MeshLod *_lods, int _lod_count, glm::vec4 _bounds);
+	~ComplexModel();
 };
 
+#define STREAM_BUFFER_FRAMES 3
+
+struct StreamBuffer {
+	GLuint buffer;
+	unsigned char *mapped;
+
+	size_t region_size;
+	size_t head;
+	int region;
+
+	GLsync fences[STREAM_BUFFER_FRAMES];
+
+	StreamBuffer(size_t _region_size);
+	~StreamBuffer();
+
+	void begin_frame();
+	void *alloc(size_t count, size_t stride, GLuint *first_element);
+	bool fits(size_t count, size_t stride);
+	size_t available(size_t stride);
+	void end_frame();
+};
+
+struct IoBuffer;
+void async_release(IoBuffer *buffer);
+
+struct MeshData;
+struct VfsFile;
+bool parse_obj(const char *path, const VfsFile *file, MeshData *mesh);
+void optimize_mesh(MeshData *mesh);
+void generate_lods(MeshData *mesh);
+
 struct Platformer;
 struct World;
 void reset_world(World *world);
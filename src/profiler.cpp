@@ -0,0 +1,156 @@
+/*
+ * Scoped CPU instrumentation. PROFILE_ZONE("name") records how long the
+ * enclosing scope took while a capture is running; profiler_stop writes the
+ * capture as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev).
+ *
+ * Zones only exist when PLATFORMER_PROFILE is defined (Debug builds, or
+ * Release with premake's --profile option); otherwise they compile to
+ * nothing. When compiled in but not capturing a zone costs one branch.
+ * Zone names must be string literals, only the pointer is stored.
+ */
+#define PROFILER_MAX_EVENTS (1 << 20)
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PLATFORMER_PROFILE
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
+
+struct ProfileEvent {
+	const char *name;
+	double start_us;
+	double end_us;
+};
+
+struct ProfileThread {
+	int id;
+	std::mutex mutex;
+	std::vector<ProfileEvent> events;
+};
+
+static std::atomic<bool> profiler_enabled(false);
+static std::atomic<int> profiler_event_count(0);
+static std::mutex profiler_threads_mutex;
+static std::vector<ProfileThread *> profiler_threads;
+static std::string profiler_path;
+
+double profiler_clock_us() {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileThread *profiler_thread() {
+	thread_local ProfileThread *thread = 0;
+
+	if (!thread) {
+		std::lock_guard<std::mutex> lock(profiler_threads_mutex);
+		thread = new ProfileThread();
+		thread->id = profiler_threads.size() + 1;
+		profiler_threads.push_back(thread);
+	}
+
+	return thread;
+}
+
+void profiler_record(const char *name, double start_us, double end_us) {
+	if (profiler_event_count.fetch_add(1, std::memory_order_relaxed) >= PROFILER_MAX_EVENTS) {
+		return;
+	}
+
+	ProfileThread *thread = profiler_thread();
+	std::lock_guard<std::mutex> lock(thread->mutex);
+	thread->events.push_back({ name, start_us, end_us });
+}
+
+struct ProfileZone {
+	const char *name;
+	double start_us;
+	bool active;
+
+	ProfileZone(const char *_name) {
+		active = profiler_enabled.load(std::memory_order_relaxed);
+		if (active) {
+			name = _name;
+			start_us = profiler_clock_us();
+		}
+	}
+
+	~ProfileZone() {
+		if (active) {
+			profiler_record(name, start_us, profiler_clock_us());
+		}
+	}
+};
+
+bool profiler_capturing() {
+	return profiler_enabled.load();
+}
+
+void profiler_start(const char *path) {
+	std::lock_guard<std::mutex> lock(profiler_threads_mutex);
+
+	for (ProfileThread *thread : profiler_threads) {
+		std::lock_guard<std::mutex> thread_lock(thread->mutex);
+		thread->events.clear();
+	}
+
+	profiler_path = path;
+	profiler_event_count = 0;
+	profiler_enabled = true;
+}
+
+void write_json_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (; *str; ++str) {
+		if (*str == '"' || *str == '\\') {
+			fputc('\\', out);
+		}
+		fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+bool profiler_stop() {
+	profiler_enabled = false;
+
+	FILE *out = fopen(profiler_path.c_str(), "w");
+	if (!out) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(profiler_threads_mutex);
+
+	/* timestamps are made relative to the first event so the viewer opens at 0 */
+	double origin = -1.0;
+	for (ProfileThread *thread : profiler_threads) {
+		std::lock_guard<std::mutex> thread_lock(thread->mutex);
+		for (const ProfileEvent &event : thread->events) {
+			if (origin < 0.0 || event.start_us < origin) {
+				origin = event.start_us;
+			}
+		}
+	}
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	bool first = true;
+	for (ProfileThread *thread : profiler_threads) {
+		std::lock_guard<std::mutex> thread_lock(thread->mutex);
+
+		for (const ProfileEvent &event : thread->events) {
+			fprintf(out, first ? "{\"name\":" : ",\n{\"name\":");
+			write_json_string(out, event.name);
+			fprintf(out, ",\"cat\":\"cpu\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+				event.start_us - origin, event.end_us - event.start_us, thread->id);
+			first = false;
+		}
+		thread->events.clear();
+	}
+
+	fprintf(out, "\n]}\n");
+	fclose(out);
+
+	return true;
+}
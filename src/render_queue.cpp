@@ -0,0 +1,258 @@
+#define RENDER_PASS_OPAQUE 0
+#define RENDER_PASS_TRANSLUCENT 1
+
+#define ATTRIB_INSTANCE_MATRIX 3
+#define ATTRIB_INSTANCE_COLOR 7
+#define ATTRIB_INSTANCE_LAYER 8
+
+#define RENDER_QUEUE_MAX_DEPTH 256.0f
+
+/*
+ * Sort key layout, most significant first:
+ *   63..60 pass, 59..52 shader, 51..40 texture, 39..28 mesh, 27..26 lod,
+ *   25..2 depth
+ * GL names are truncated to their field width, a collision only costs an
+ * extra state change, never a wrong draw. The lod sits above depth so the
+ * instances of one level stay together as one run.
+ */
+#define KEY_PASS_SHIFT 60
+#define KEY_SHADER_SHIFT 52
+#define KEY_TEXTURE_SHIFT 40
+#define KEY_MESH_SHIFT 28
+#define KEY_LOD_SHIFT 26
+#define KEY_DEPTH_SHIFT 2
+
+#define KEY_DEPTH_BITS 24
+
+struct RenderStats {
+	unsigned int draw_calls;
+	unsigned int instances;
+	unsigned int triangles;
+	unsigned int dropped; /* draws that found no room in the stream buffer */
+};
+
+static RenderStats render_stats;
+static RenderStats last_frame_render_stats;
+
+void render_stats_end_frame() {
+	/* once when it starts, not every frame it goes on */
+	if (render_stats.dropped > 0 && last_frame_render_stats.dropped == 0) {
+		LOG(LOG_WARNING, "Stream buffer full, dropping draws", log_int("dropped", render_stats.dropped));
+	}
+
+	last_frame_render_stats = render_stats;
+	render_stats = {};
+}
+
+struct InstanceData {
+	glm::mat4 model_matrix;
+	glm::vec4 color;
+	float layer; /* texture array layer */
+};
+
+struct DrawItem {
+	uint64_t key;
+
+	Shader *shader;
+	GLenum texture_target;
+	Texture textures[2];
+
+	GLuint vao;
+	GLuint element_count;
+	GLenum index_type; /* GL_NONE for non indexed meshes */
+	size_t index_offset; /* in the element buffer */
+	int lod; /* which of the mesh's levels index_offset points at */
+
+	InstanceData instance;
+};
+
+void bind_instance_attributes(GLuint vao, GLuint buffer) {
+	gl_bind_vertex_array(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+	/* a mat4 attribute takes four consecutive vec4 locations */
+	for (int i = 0; i < 4; ++i) {
+		GLuint location = ATTRIB_INSTANCE_MATRIX + i;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, 4, GL_FLOAT, 0, sizeof(InstanceData), (void *)(offsetof(InstanceData, model_matrix) + sizeof(glm::vec4) * i));
+		glVertexAttribDivisor(location, 1);
+	}
+
+	glEnableVertexAttribArray(ATTRIB_INSTANCE_COLOR);
+	glVertexAttribPointer(ATTRIB_INSTANCE_COLOR, 4, GL_FLOAT, 0, sizeof(InstanceData), (void *)offsetof(InstanceData, color));
+	glVertexAttribDivisor(ATTRIB_INSTANCE_COLOR, 1);
+
+	glEnableVertexAttribArray(ATTRIB_INSTANCE_LAYER);
+	glVertexAttribPointer(ATTRIB_INSTANCE_LAYER, 1, GL_FLOAT, 0, sizeof(InstanceData), (void *)offsetof(InstanceData, layer));
+	glVertexAttribDivisor(ATTRIB_INSTANCE_LAYER, 1);
+}
+
+DrawItem draw_item(Shader *shader, ComplexModel *model, Texture texture_array, int layer) {
+	DrawItem item = {};
+	item.shader = shader;
+	item.texture_target = GL_TEXTURE_2D_ARRAY;
+	item.textures[0] = texture_array;
+	item.instance.layer = layer;
+	item.vao = model->vao;
+	item.element_count = model->indices_count;
+	item.index_type = model->index_type;
+	item.index_offset = model->index_offset;
+	return item;
+}
+
+DrawItem draw_item(Shader *shader, SimpleModel *model, Texture texture0, Texture texture1) {
+	DrawItem item = {};
+	item.shader = shader;
+	item.texture_target = GL_TEXTURE_2D;
+	item.textures[0] = texture0;
+	item.textures[1] = texture1;
+	item.vao = model->vao;
+	item.element_count = model->vertices_count;
+	item.index_type = GL_NONE;
+	return item;
+}
+
+bool same_state(const DrawItem &a, const DrawItem &b) {
+	return a.shader == b.shader && a.vao == b.vao && a.texture_target == b.texture_target &&
+		a.textures[0] == b.textures[0] && a.textures[1] == b.textures[1] &&
+		a.element_count == b.element_count && a.index_type == b.index_type && a.index_offset == b.index_offset;
+}
+
+struct RenderQueue {
+	TaggedVector<DrawItem, MEM_RENDER> items;
+	TaggedVector<uint32_t, MEM_RENDER> order;
+	TaggedVector<uint32_t, MEM_RENDER> scratch;
+
+	glm::mat4 view_matrix;
+
+	void begin(glm::mat4 view) {
+		view_matrix = view;
+		items.clear();
+	}
+
+	void submit(DrawItem item, int pass) {
+		glm::vec4 view_pos = view_matrix * item.instance.model_matrix[3];
+		float depth = glm::clamp(-view_pos.z / RENDER_QUEUE_MAX_DEPTH, 0.0f, 1.0f);
+
+		uint64_t depth_bits = (uint64_t)(depth * ((1 << KEY_DEPTH_BITS) - 1));
+		if (pass == RENDER_PASS_TRANSLUCENT) {
+			/* blended geometry goes back to front */
+			depth_bits = ((1 << KEY_DEPTH_BITS) - 1) - depth_bits;
+		}
+
+		item.key = ((uint64_t)pass << KEY_PASS_SHIFT) |
+			((uint64_t)(item.shader->program & 0xff) << KEY_SHADER_SHIFT) |
+			((uint64_t)(item.textures[0] & 0xfff) << KEY_TEXTURE_SHIFT) |
+			((uint64_t)(item.vao & 0xfff) << KEY_MESH_SHIFT) |
+			((uint64_t)(item.lod & 0x3) << KEY_LOD_SHIFT) |
+			(depth_bits << KEY_DEPTH_SHIFT);
+
+		items.push_back(item);
+	}
+
+	/* LSD radix sort over the keys, one byte per pass */
+	void sort() {
+		size_t count = items.size();
+		order.resize(count);
+		scratch.resize(count);
+
+		for (size_t i = 0; i < count; ++i) {
+			order[i] = i;
+		}
+
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t histogram[257] = {};
+
+			for (size_t i = 0; i < count; ++i) {
+				histogram[((items[i].key >> shift) & 0xff) + 1]++;
+			}
+
+			/* every key shares this byte, nothing to reorder */
+			bool skip = false;
+			for (int b = 1; b <= 256; ++b) {
+				if (histogram[b] == count) {
+					skip = true;
+					break;
+				}
+			}
+			if (skip) {
+				continue;
+			}
+
+			for (int b = 1; b <= 256; ++b) {
+				histogram[b] += histogram[b - 1];
+			}
+
+			for (size_t i = 0; i < count; ++i) {
+				uint32_t index = order[i];
+				scratch[histogram[(items[index].key >> shift) & 0xff]++] = index;
+			}
+
+			order.swap(scratch);
+		}
+	}
+
+	/*
+	 * Instance data is written in sorted order, so every run of items sharing
+	 * the same state becomes a single instanced draw. Items beyond what the
+	 * stream region has room for are dropped, the end of the order goes first.
+	 */
+	void execute(StreamBuffer *stream) {
+		size_t count = std::min(order.size(), stream->available(sizeof(InstanceData)));
+		render_stats.dropped += order.size() - count;
+		if (count == 0) {
+			return;
+		}
+
+		GLuint base_instance;
+		InstanceData *instances = (InstanceData *)stream->alloc(count, sizeof(InstanceData), &base_instance);
+
+		for (size_t i = 0; i < count; ++i) {
+			instances[i] = items[order[i]].instance;
+		}
+
+		size_t first = 0;
+		while (first < count) {
+			const DrawItem &item = items[order[first]];
+
+			size_t last = first + 1;
+			while (last < count && same_state(item, items[order[last]])) {
+				last++;
+			}
+
+			item.shader->use();
+
+			for (int unit = 0; unit < 2; ++unit) {
+				gl_active_texture(unit);
+				gl_bind_texture(item.texture_target, item.textures[unit]);
+			}
+			gl_active_texture(0);
+
+			gl_bind_vertex_array(item.vao);
+
+			GLsizei instance_count = last - first;
+			render_stats.draw_calls++;
+			render_stats.instances += instance_count;
+			render_stats.triangles += item.element_count / 3 * instance_count;
+			if (item.index_type == GL_NONE) {
+				glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, item.element_count, instance_count, base_instance + first);
+			} else {
+				glDrawElementsInstancedBaseInstance(GL_TRIANGLES, item.element_count, item.index_type, (void *)item.index_offset, instance_count, base_instance + first);
+			}
+
+			first = last;
+		}
+	}
+
+	void destroy() {
+		release(items);
+		release(order);
+		release(scratch);
+	}
+
+	void flush(StreamBuffer *stream) {
+		sort();
+		execute(stream);
+		items.clear();
+	}
+};
@@ -0,0 +1,83 @@
+#define FRAME_TIME_BUDGET_MS 16.6f
+
+#define MAIN_SCALE_MIN 0.5f
+#define WATER_SCALE_MIN 0.25f
+#define RESOLUTION_SCALE_STEP 0.125f
+
+/* frames to wait after a change so the new frame times can settle */
+#define RESOLUTION_COOLDOWN 30
+
+/* a step up must be predicted to land below this fraction of the budget */
+#define RESOLUTION_UP_MARGIN 0.8f
+
+/*
+ * Keeps the GPU time of a frame inside the budget by trading internal
+ * resolution. It is fed GPU time rather than wall clock time, which under
+ * vsync never drops below the refresh interval and would never let it scale
+ * back up. The water pass is cheaper to degrade, so it goes down first and
+ * comes back up last; the main pass only follows once the water pass is at
+ * its minimum.
+ *
+ * Going up is hysteretic: a pass's GPU time grows with its pixel count, so
+ * a step up is only taken when the frame, with that pass's time scaled by
+ * the step's area, still stays under RESOLUTION_UP_MARGIN of the budget;
+ * otherwise it would just step back down.
+ */
+struct ResolutionScaler {
+	float budget_ms = FRAME_TIME_BUDGET_MS;
+	bool enabled = true;
+
+	float main_scale = 1.0f;
+	float water_scale = 1.0f;
+
+	/* GPU times, the whole frame and the two scaled passes */
+	float smoothed_ms = 0.0f;
+	float smoothed_main_ms = 0.0f;
+	float smoothed_water_ms = 0.0f;
+	int cooldown = RESOLUTION_COOLDOWN;
+
+	static float smooth(float smoothed, float ms) {
+		return smoothed == 0.0f ? ms : smoothed + (ms - smoothed) * 0.05f;
+	}
+
+	/* takes the GPU times of the last measured frame, returns true when one of the scales changed */
+	bool update(float frame_ms, float main_ms, float water_ms) {
+		smoothed_ms = smooth(smoothed_ms, frame_ms);
+		smoothed_main_ms = smooth(smoothed_main_ms, main_ms);
+		smoothed_water_ms = smooth(smoothed_water_ms, water_ms);
+
+		if (!enabled || --cooldown > 0) {
+			return false;
+		}
+
+		if (smoothed_ms > budget_ms) {
+			if (water_scale > WATER_SCALE_MIN) {
+				water_scale = std::max(WATER_SCALE_MIN, water_scale - RESOLUTION_SCALE_STEP);
+			} else if (main_scale > MAIN_SCALE_MIN) {
+				main_scale = std::max(MAIN_SCALE_MIN, main_scale - RESOLUTION_SCALE_STEP);
+			} else {
+				return false;
+			}
+		} else if (main_scale < 1.0f || water_scale < 1.0f) {
+			bool main = main_scale < 1.0f;
+			float *scale = main ? &main_scale : &water_scale;
+			float pass_ms = main ? smoothed_main_ms : smoothed_water_ms;
+
+			float next = std::min(1.0f, *scale + RESOLUTION_SCALE_STEP);
+			float predicted_ms = smoothed_ms + pass_ms * ((next * next) / (*scale * *scale) - 1.0f);
+			if (predicted_ms >= budget_ms * RESOLUTION_UP_MARGIN) {
+				return false;
+			}
+			*scale = next;
+		} else {
+			return false;
+		}
+
+		cooldown = RESOLUTION_COOLDOWN;
+		return true;
+	}
+};
+
+int scaled_size(int size, float scale) {
+	return std::max(1, (int)(size * scale + 0.5f));
+}
@@ -0,0 +1,308 @@
+/*
+ * Resource registry. Textures, meshes and shaders are acquired by path and
+ * used through handles. Acquiring a path that is already loaded, or still
+ * loading, hands out the same resource with one more reference, and the
+ * last release unloads it. A handle is a slot index plus the generation the
+ * slot had when it was handed out; an unloaded slot is reused with the next
+ * generation, so a stale handle resolves to nothing instead of to whatever
+ * took its place. Loads go through the asset loader and a resource resolves
+ * to nothing until it has arrived: get_texture returns 0 and get_mesh and
+ * get_shader return null for a handle that is still loading, released or
+ * stale, so callers check the result (or resource_ready) before using it.
+ */
+#define RESOURCE_TEXTURE 0
+#define RESOURCE_MESH 1
+#define RESOURCE_SHADER 2
+#define RESOURCE_KIND_COUNT 3
+
+const char *resource_kind_names[RESOURCE_KIND_COUNT] = { "texture", "mesh", "shader" };
+
+struct ResourceHandle {
+	uint32_t index = 0; /* slot + 1, 0 is no resource */
+	uint32_t generation = 0;
+};
+
+struct ResourceSlot {
+	int kind;
+	uint32_t generation = 0;
+	int refs = 0;
+	bool loaded;
+	std::string key;
+
+	Texture texture;
+	ComplexModel *mesh;
+	Shader *shader;
+
+	/* run once the resource arrives */
+	std::vector<std::function<void()>> waiting;
+};
+
+struct ResourceRegistry {
+	AssetLoader *loader;
+
+	TaggedVector<ResourceSlot, MEM_GENERAL> slots;
+	TaggedVector<uint32_t, MEM_GENERAL> free_slots;
+	std::unordered_map<std::string, uint32_t> by_key; /* slot index */
+	int live[RESOURCE_KIND_COUNT];
+};
+
+void resource_registry_init(ResourceRegistry *registry, AssetLoader *loader) {
+	registry->loader = loader;
+	for (int kind = 0; kind < RESOURCE_KIND_COUNT; ++kind) {
+		registry->live[kind] = 0;
+	}
+}
+
+/* the slot behind handle while it still refers to a resource of kind, null otherwise */
+ResourceSlot *resource_slot(ResourceRegistry *registry, ResourceHandle handle, int kind) {
+	if (handle.index == 0 || handle.index > registry->slots.size()) {
+		return 0;
+	}
+
+	ResourceSlot *slot = &registry->slots[handle.index - 1];
+	if (slot->generation != handle.generation || slot->refs == 0 || (kind >= 0 && slot->kind != kind)) {
+		return 0;
+	}
+
+	return slot;
+}
+
+/* one more reference to the slot for key, a new slot if nothing has it yet */
+ResourceHandle acquire_slot(ResourceRegistry *registry, int kind, const std::string &key, bool *created) {
+	auto found = registry->by_key.find(key);
+	if (found != registry->by_key.end()) {
+		ResourceSlot *slot = &registry->slots[found->second];
+		slot->refs++;
+		*created = false;
+
+		ResourceHandle handle;
+		handle.index = found->second + 1;
+		handle.generation = slot->generation;
+		return handle;
+	}
+
+	uint32_t index;
+	if (!registry->free_slots.empty()) {
+		index = registry->free_slots.back();
+		registry->free_slots.pop_back();
+	} else {
+		index = registry->slots.size();
+		registry->slots.emplace_back();
+	}
+
+	ResourceSlot *slot = &registry->slots[index];
+	slot->kind = kind;
+	slot->refs = 1;
+	slot->loaded = false;
+	slot->key = key;
+	slot->texture = 0;
+	slot->mesh = 0;
+	slot->shader = 0;
+
+	registry->by_key[key] = index;
+	registry->live[kind]++;
+	*created = true;
+
+	ResourceHandle handle;
+	handle.index = index + 1;
+	handle.generation = slot->generation;
+	return handle;
+}
+
+void free_resource(Texture texture, ComplexModel *mesh, Shader *shader) {
+	if (texture) {
+		delete_texture(texture);
+	}
+	delete mesh;
+	delete shader;
+}
+
+/* stores what a load produced, or frees it if every reference went away meanwhile */
+void resource_arrived(ResourceRegistry *registry, ResourceHandle handle, Texture texture, ComplexModel *mesh, Shader *shader) {
+	ResourceSlot *slot = resource_slot(registry, handle, -1);
+	if (!slot) {
+		free_resource(texture, mesh, shader);
+		return;
+	}
+
+	slot->texture = texture;
+	slot->mesh = mesh;
+	slot->shader = shader;
+	slot->loaded = true;
+
+	/* a callback may acquire more, which can move the slots */
+	std::vector<std::function<void()>> waiting;
+	waiting.swap(slot->waiting);
+	for (std::function<void()> &ready : waiting) {
+		ready();
+	}
+}
+
+void when_resource_ready(ResourceRegistry *registry, ResourceHandle handle, std::function<void()> ready) {
+	ResourceSlot *slot = resource_slot(registry, handle, -1);
+	if (!slot) {
+		return;
+	}
+
+	if (slot->loaded) {
+		ready();
+	} else {
+		slot->waiting.push_back(std::move(ready));
+	}
+}
+
+/* whether the resource has arrived, get_* resolve it from then on */
+bool resource_ready(ResourceRegistry *registry, ResourceHandle handle) {
+	ResourceSlot *slot = resource_slot(registry, handle, -1);
+	return slot && slot->loaded;
+}
+
+Texture get_texture(ResourceRegistry *registry, ResourceHandle handle) {
+	ResourceSlot *slot = resource_slot(registry, handle, RESOURCE_TEXTURE);
+	return slot ? slot->texture : 0;
+}
+
+ComplexModel *get_mesh(ResourceRegistry *registry, ResourceHandle handle) {
+	ResourceSlot *slot = resource_slot(registry, handle, RESOURCE_MESH);
+	return slot ? slot->mesh : 0;
+}
+
+Shader *get_shader(ResourceRegistry *registry, ResourceHandle handle) {
+	ResourceSlot *slot = resource_slot(registry, handle, RESOURCE_SHADER);
+	return slot ? slot->shader : 0;
+}
+
+/* ready runs once the texture has arrived, right away if it already has */
+ResourceHandle acquire_texture(ResourceRegistry *registry, const char *path, std::function<void(Texture)> ready) {
+	bool created;
+	ResourceHandle handle = acquire_slot(registry, RESOURCE_TEXTURE, path, &created);
+
+	if (created) {
+		request_texture(registry->loader, path, [registry, handle](Texture texture) {
+			resource_arrived(registry, handle, texture, 0, 0);
+		});
+	}
+
+	if (ready) {
+		when_resource_ready(registry, handle, [registry, handle, ready] {
+			ready(get_texture(registry, handle));
+		});
+	}
+
+	return handle;
+}
+
+ResourceHandle acquire_texture_array(ResourceRegistry *registry, const char **paths, int count, std::function<void(Texture)> ready) {
+	std::string key = "array";
+	for (int i = 0; i < count; ++i) {
+		key.append(":").append(paths[i]);
+	}
+
+	bool created;
+	ResourceHandle handle = acquire_slot(registry, RESOURCE_TEXTURE, key, &created);
+
+	if (created) {
+		request_texture_array(registry->loader, paths, count, [registry, handle](Texture texture) {
+			resource_arrived(registry, handle, texture, 0, 0);
+		});
+	}
+
+	if (ready) {
+		when_resource_ready(registry, handle, [registry, handle, ready] {
+			ready(get_texture(registry, handle));
+		});
+	}
+
+	return handle;
+}
+
+ResourceHandle acquire_mesh(ResourceRegistry *registry, const char *path, int format, std::function<void(ComplexModel *)> ready) {
+	bool created;
+	ResourceHandle handle = acquire_slot(registry, RESOURCE_MESH, std::string(path) + ":" + mesh_format_names[format], &created);
+
+	if (created) {
+		request_mesh(registry->loader, path, format, [registry, handle](ComplexModel *model) {
+			resource_arrived(registry, handle, 0, model, 0);
+		});
+	}
+
+	if (ready) {
+		when_resource_ready(registry, handle, [registry, handle, ready] {
+			ready(get_mesh(registry, handle));
+		});
+	}
+
+	return handle;
+}
+
+/* each set of defines is a permutation of its own */
+ResourceHandle acquire_shader(ResourceRegistry *registry, const char *vert_path, const char *frag_path, const char *defines, std::function<void(Shader *)> ready) {
+	bool created;
+	ResourceHandle handle = acquire_slot(registry, RESOURCE_SHADER, std::string(vert_path) + ":" + frag_path + ":" + (defines ? defines : ""), &created);
+
+	if (created) {
+		request_shader(registry->loader, vert_path, frag_path, defines, [registry, handle](Shader *shader) {
+			resource_arrived(registry, handle, 0, 0, shader);
+		});
+	}
+
+	if (ready) {
+		when_resource_ready(registry, handle, [registry, handle, ready] {
+			ready(get_shader(registry, handle));
+		});
+	}
+
+	return handle;
+}
+
+/* drops a reference and clears the handle, the last one unloads the resource */
+void release_resource(ResourceRegistry *registry, ResourceHandle *handle) {
+	if (handle->index == 0) {
+		return;
+	}
+
+	ResourceSlot *slot = resource_slot(registry, *handle, -1);
+	uint32_t index = handle->index - 1;
+	*handle = ResourceHandle();
+
+	if (!slot) {
+		LOG(LOG_WARNING, "Releasing a stale resource handle", log_int("index", index));
+		return;
+	}
+
+	if (--slot->refs > 0) {
+		return;
+	}
+
+	/* still loading, resource_arrived frees it once it is there */
+	if (slot->loaded) {
+		free_resource(slot->texture, slot->mesh, slot->shader);
+	}
+
+	registry->by_key.erase(slot->key);
+	registry->live[slot->kind]--;
+	registry->free_slots.push_back(index);
+
+	slot->key.clear();
+	slot->waiting.clear();
+	slot->generation++;
+}
+
+/* frees whatever is still referenced, which is a leak of whoever held it */
+void resource_registry_destroy(ResourceRegistry *registry) {
+	for (uint32_t i = 0; i < registry->slots.size(); ++i) {
+		ResourceSlot *slot = &registry->slots[i];
+		if (slot->refs == 0) {
+			continue;
+		}
+
+		LOG(LOG_WARNING, "Resource still referenced", log_str("kind", resource_kind_names[slot->kind]), log_str("key", slot->key.c_str()), log_int("refs", slot->refs));
+		if (slot->loaded) {
+			free_resource(slot->texture, slot->mesh, slot->shader);
+		}
+	}
+
+	release(registry->slots);
+	release(registry->free_slots);
+	registry->by_key.clear();
+}
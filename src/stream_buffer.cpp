@@ -0,0 +1,109 @@
+/*
+ * Persistently mapped buffer for data that changes every frame. The storage is
+ * split into STREAM_BUFFER_FRAMES regions: the CPU fills the region of the
+ * current frame while the GPU is still reading the previous ones, and a fence
+ * per region makes sure a region is only reused once the GPU is done with it.
+ */
+StreamBuffer::StreamBuffer(size_t _region_size) {
+	region_size = _region_size;
+	head = 0;
+	region = 0;
+
+	for (int i = 0; i < STREAM_BUFFER_FRAMES; ++i) {
+		fences[i] = 0;
+	}
+
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr total_size = region_size * STREAM_BUFFER_FRAMES;
+
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferStorage(GL_ARRAY_BUFFER, total_size, 0, flags);
+	mapped = (unsigned char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, total_size, flags);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (!mapped) {
+		die("Failed to map stream buffer!");
+	}
+
+	gpu_memory_track(GPU_MEM_BUFFER, buffer, total_size, "stream buffer");
+	gl_label(GL_BUFFER, buffer, "stream buffer");
+}
+
+StreamBuffer::~StreamBuffer() {
+	for (int i = 0; i < STREAM_BUFFER_FRAMES; ++i) {
+		if (fences[i]) {
+			glDeleteSync(fences[i]);
+		}
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	gpu_memory_release(GPU_MEM_BUFFER, buffer);
+	glDeleteBuffers(1, &buffer);
+}
+
+void StreamBuffer::begin_frame() {
+	GLsync fence = fences[region];
+	head = 0;
+
+	if (!fence) {
+		return;
+	}
+
+	/* with three regions in flight this is normally already signaled */
+	while (true) {
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+			break;
+		}
+		if (result == GL_WAIT_FAILED) {
+			die("Waiting for stream buffer fence failed!");
+		}
+	}
+
+	glDeleteSync(fence);
+	fences[region] = 0;
+}
+
+/*
+ * Reserves count elements of stride bytes in the current region. The returned
+ * pointer is write-only; first_element is the index of the first element when
+ * the whole buffer is viewed as an array of stride sized elements, which is
+ * what base instance / base vertex draws expect. Null when the region has no
+ * room left, callers check fits or available first and drop what does not.
+ */
+void *StreamBuffer::alloc(size_t count, size_t stride, GLuint *first_element) {
+	size_t region_start = region * region_size;
+	size_t offset = region_start + head;
+
+	offset = (offset + stride - 1) / stride * stride;
+
+	if (offset + count * stride > region_start + region_size) {
+		return 0;
+	}
+
+	head = offset + count * stride - region_start;
+	*first_element = offset / stride;
+
+	return mapped + offset;
+}
+
+/* whether alloc(count, stride) still fits in the current region */
+bool StreamBuffer::fits(size_t count, size_t stride) {
+	return count <= available(stride);
+}
+
+/* how many elements of stride bytes the current region still has room for */
+size_t StreamBuffer::available(size_t stride) {
+	size_t offset = (region * region_size + head + stride - 1) / stride * stride;
+	size_t end = (region + 1) * region_size;
+	return offset < end ? (end - offset) / stride : 0;
+}
+
+void StreamBuffer::end_frame() {
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region + 1) % STREAM_BUFFER_FRAMES;
+}
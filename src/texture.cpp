@@ -0,0 +1,503 @@
+/*
+ * Baked textures. The Bake tool decodes an image once and writes it next to
+ * the source as a .tex file: a header indexing the levels, then the full mip
+ * chain, finest first, already in the texture's GPU format. Loading maps the
+ * file and uploads every level as it is; nothing is decoded, filtered or
+ * compressed at startup. Like meshes, the header records the size and
+ * modification time of the source, and a stale or missing bake falls back
+ * to decoding the source and glGenerateMipmap.
+ *
+ * Formats, chosen per texture:
+ *   TEXTURE_FORMAT_RGBA8  4 bytes per texel
+ *   TEXTURE_FORMAT_BC1    8 bytes per 4x4 block, opaque (DXT1)
+ *   TEXTURE_FORMAT_BC3    16 bytes per 4x4 block, BC1 colors plus
+ *                         interpolated alpha (DXT5)
+ * Mips are 2x2 box filtered like glGenerateMipmap. Compressed blocks take
+ * their endpoints from the extent of the block's colors along their
+ * principal axis, inset by a sixteenth.
+ */
+#define TEXTURE_MAGIC 0x58455450 /* "PTEX" */
+#define TEXTURE_VERSION 1
+#define TEXTURE_MAX_LEVELS 16
+
+#define TEXTURE_FORMAT_RGBA8 0
+#define TEXTURE_FORMAT_BC1 1
+#define TEXTURE_FORMAT_BC3 2
+
+const char *texture_format_names[] = { "rgba8", "bc1", "bc3" };
+
+struct TextureLevel {
+	uint32_t offset; /* from the first level */
+	uint32_t size;
+};
+
+struct TextureHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;
+	uint32_t data_offset; /* from the start of the file */
+	uint32_t data_size;
+	TextureLevel levels[TEXTURE_MAX_LEVELS];
+};
+
+/* a texture in its GPU format, all levels back to back */
+struct EncodedTexture {
+	int format;
+	int width;
+	int height;
+	int level_count;
+	TextureLevel levels[TEXTURE_MAX_LEVELS];
+	TaggedVector<unsigned char, MEM_TEXTURE> data;
+};
+
+/* an opened bake, data points at its first level */
+struct BakedTexture {
+	VfsFile file;
+	const TextureHeader *header;
+	const unsigned char *data;
+};
+
+int mip_levels(int width, int height) {
+	int levels = 1;
+	while ((std::max(width, height) >> levels) > 0) {
+		levels++;
+	}
+	return levels;
+}
+
+bool texture_format_compressed(int format) {
+	return format != TEXTURE_FORMAT_RGBA8;
+}
+
+size_t texture_level_size(int format, int width, int height) {
+	if (!texture_format_compressed(format)) {
+		return (size_t)width * height * 4;
+	}
+
+	size_t blocks = (size_t)((width + 3) / 4) * ((height + 3) / 4);
+	return blocks * (format == TEXTURE_FORMAT_BC1 ? 8 : 16);
+}
+
+/* compressed formats need S3TC, which nearly every desktop driver has */
+bool texture_format_supported(int format) {
+	return !texture_format_compressed(format) || GLEW_EXT_texture_compression_s3tc;
+}
+
+/* halves a level with a 2x2 box filter, the last row or column of an odd size repeats */
+void downsample_rgba8(const unsigned char *src, int width, int height, unsigned char *dst) {
+	int dst_width = std::max(width / 2, 1), dst_height = std::max(height / 2, 1);
+
+	for (int y = 0; y < dst_height; ++y) {
+		int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+
+		for (int x = 0; x < dst_width; ++x) {
+			int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+
+			for (int c = 0; c < 4; ++c) {
+				int sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+					src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+				dst[(y * dst_width + x) * 4 + c] = (sum + 2) / 4;
+			}
+		}
+	}
+}
+
+inline uint16_t pack_565(glm::vec3 color) {
+	int r = (int)(color.r * 31.0f / 255.0f + 0.5f);
+	int g = (int)(color.g * 63.0f / 255.0f + 0.5f);
+	int b = (int)(color.b * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline glm::ivec3 unpack_565(uint16_t packed) {
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	return glm::ivec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+/* the block's colors in four-color mode, which BC3 always uses */
+void bc_color_palette(uint16_t c0, uint16_t c1, bool four_colors, glm::ivec3 palette[4]) {
+	palette[0] = unpack_565(c0);
+	palette[1] = unpack_565(c1);
+
+	if (four_colors) {
+		palette[2] = (palette[0] * 2 + palette[1]) / 3;
+		palette[3] = (palette[0] + palette[1] * 2) / 3;
+	} else {
+		palette[2] = (palette[0] + palette[1]) / 2;
+		palette[3] = glm::ivec3(0);
+	}
+}
+
+/* 16 RGBA texels, row by row, to a BC1 block */
+void encode_bc1_block(const unsigned char *texels, unsigned char *out) {
+	glm::vec3 colors[16];
+	glm::vec3 mean(0.0f);
+	for (int i = 0; i < 16; ++i) {
+		colors[i] = glm::vec3(texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2]);
+		mean += colors[i];
+	}
+	mean /= 16.0f;
+
+	float cov[6] = {}; /* rr rg rb gg gb bb */
+	for (int i = 0; i < 16; ++i) {
+		glm::vec3 d = colors[i] - mean;
+		cov[0] += d.r * d.r; cov[1] += d.r * d.g; cov[2] += d.r * d.b;
+		cov[3] += d.g * d.g; cov[4] += d.g * d.b; cov[5] += d.b * d.b;
+	}
+
+	/* a few rounds of power iteration find the principal axis */
+	glm::vec3 axis(1.0f);
+	for (int i = 0; i < 8; ++i) {
+		glm::vec3 next(cov[0] * axis.r + cov[1] * axis.g + cov[2] * axis.b,
+			cov[1] * axis.r + cov[3] * axis.g + cov[4] * axis.b,
+			cov[2] * axis.r + cov[4] * axis.g + cov[5] * axis.b);
+		float length = glm::length(next);
+		if (length < 1e-6f) {
+			break;
+		}
+		axis = next / length;
+	}
+
+	float low = FLT_MAX, high = -FLT_MAX;
+	for (int i = 0; i < 16; ++i) {
+		float t = glm::dot(colors[i] - mean, axis);
+		low = std::min(low, t);
+		high = std::max(high, t);
+	}
+
+	glm::vec3 e0 = mean + axis * high, e1 = mean + axis * low;
+	glm::vec3 inset = (e0 - e1) / 16.0f;
+	e0 = glm::clamp(e0 - inset, 0.0f, 255.0f);
+	e1 = glm::clamp(e1 + inset, 0.0f, 255.0f);
+
+	uint16_t c0 = pack_565(e0), c1 = pack_565(e1);
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+
+	glm::ivec3 palette[4];
+	bc_color_palette(c0, c1, true, palette);
+
+	uint32_t indices = 0;
+	if (c0 != c1) {
+		for (int i = 0; i < 16; ++i) {
+			glm::ivec3 color(texels[i * 4], texels[i * 4 + 1], texels[i * 4 + 2]);
+			int best = 0, best_distance = INT_MAX;
+			for (int p = 0; p < 4; ++p) {
+				glm::ivec3 d = color - palette[p];
+				int distance = d.r * d.r + d.g * d.g + d.b * d.b;
+				if (distance < best_distance) {
+					best_distance = distance;
+					best = p;
+				}
+			}
+			indices |= (uint32_t)best << (i * 2);
+		}
+	}
+
+	out[0] = c0 & 0xff; out[1] = c0 >> 8;
+	out[2] = c1 & 0xff; out[3] = c1 >> 8;
+	for (int i = 0; i < 4; ++i) {
+		out[4 + i] = (indices >> (i * 8)) & 0xff;
+	}
+}
+
+/* the extremes of the block's alpha as endpoints, six interpolated values between */
+void encode_bc3_alpha_block(const unsigned char *texels, unsigned char *out) {
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		a0 = std::max(a0, (int)texels[i * 4 + 3]);
+		a1 = std::min(a1, (int)texels[i * 4 + 3]);
+	}
+
+	int palette[8] = { a0, a1 };
+	for (int i = 1; i < 7; ++i) {
+		palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+	}
+
+	uint64_t indices = 0;
+	if (a0 != a1) {
+		for (int i = 0; i < 16; ++i) {
+			int alpha = texels[i * 4 + 3];
+			int best = 0;
+			for (int p = 1; p < 8; ++p) {
+				if (abs(alpha - palette[p]) < abs(alpha - palette[best])) {
+					best = p;
+				}
+			}
+			indices |= (uint64_t)best << (i * 3);
+		}
+	}
+
+	out[0] = a0;
+	out[1] = a1;
+	for (int i = 0; i < 6; ++i) {
+		out[2 + i] = (indices >> (i * 8)) & 0xff;
+	}
+}
+
+/* the inverse, for checking what the compressor loses */
+void decode_bc_block(int format, const unsigned char *block, unsigned char *texels) {
+	const unsigned char *color = block;
+	if (format == TEXTURE_FORMAT_BC3) {
+		int palette[8] = { block[0], block[1] };
+		for (int i = 1; i < 7; ++i) {
+			palette[i + 1] = ((7 - i) * block[0] + i * block[1]) / 7;
+		}
+
+		uint64_t indices = 0;
+		for (int i = 0; i < 6; ++i) {
+			indices |= (uint64_t)block[2 + i] << (i * 8);
+		}
+		for (int i = 0; i < 16; ++i) {
+			texels[i * 4 + 3] = palette[(indices >> (i * 3)) & 7];
+		}
+		color = block + 8;
+	}
+
+	uint16_t c0 = color[0] | (color[1] << 8), c1 = color[2] | (color[3] << 8);
+	bool four_colors = format == TEXTURE_FORMAT_BC3 || c0 > c1;
+
+	glm::ivec3 palette[4];
+	bc_color_palette(c0, c1, four_colors, palette);
+
+	uint32_t indices = color[4] | (color[5] << 8) | (color[6] << 16) | ((uint32_t)color[7] << 24);
+	for (int i = 0; i < 16; ++i) {
+		int index = (indices >> (i * 2)) & 3;
+		texels[i * 4] = palette[index].r;
+		texels[i * 4 + 1] = palette[index].g;
+		texels[i * 4 + 2] = palette[index].b;
+		if (format == TEXTURE_FORMAT_BC1) {
+			texels[i * 4 + 3] = !four_colors && index == 3 ? 0 : 255;
+		}
+	}
+}
+
+/* blocks hanging over the edge repeat the last row and column */
+void compress_level(const unsigned char *pixels, int width, int height, int format, unsigned char *out) {
+	size_t block_size = format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+	unsigned char texels[16 * 4];
+
+	for (int by = 0; by < height; by += 4) {
+		for (int bx = 0; bx < width; bx += 4) {
+			for (int y = 0; y < 4; ++y) {
+				for (int x = 0; x < 4; ++x) {
+					int sx = std::min(bx + x, width - 1), sy = std::min(by + y, height - 1);
+					memcpy(&texels[(y * 4 + x) * 4], &pixels[(sy * width + sx) * 4], 4);
+				}
+			}
+
+			if (format == TEXTURE_FORMAT_BC3) {
+				encode_bc3_alpha_block(texels, out);
+				encode_bc1_block(texels, out + 8);
+			} else {
+				encode_bc1_block(texels, out);
+			}
+			out += block_size;
+		}
+	}
+}
+
+/* builds the mip chain of RGBA8 pixels and stores every level in format */
+void encode_texture(const unsigned char *pixels, int width, int height, int format, EncodedTexture *encoded) {
+	PROFILE_ZONE("encode_texture");
+
+	encoded->format = format;
+	encoded->width = width;
+	encoded->height = height;
+	encoded->level_count = std::min(mip_levels(width, height), TEXTURE_MAX_LEVELS);
+
+	size_t total = 0;
+	for (int level = 0; level < encoded->level_count; ++level) {
+		TextureLevel *entry = &encoded->levels[level];
+		entry->offset = total;
+		entry->size = texture_level_size(format, std::max(width >> level, 1), std::max(height >> level, 1));
+		total += entry->size;
+	}
+	encoded->data.resize(total);
+
+	TaggedVector<unsigned char, MEM_TEXTURE> level_pixels(pixels, pixels + (size_t)width * height * 4);
+	TaggedVector<unsigned char, MEM_TEXTURE> next;
+
+	for (int level = 0; level < encoded->level_count; ++level) {
+		int level_width = std::max(width >> level, 1), level_height = std::max(height >> level, 1);
+		unsigned char *out = encoded->data.data() + encoded->levels[level].offset;
+
+		if (texture_format_compressed(format)) {
+			compress_level(level_pixels.data(), level_width, level_height, format, out);
+		} else {
+			memcpy(out, level_pixels.data(), level_pixels.size());
+		}
+
+		if (level + 1 < encoded->level_count) {
+			next.resize(texture_level_size(TEXTURE_FORMAT_RGBA8, std::max(level_width / 2, 1), std::max(level_height / 2, 1)));
+			downsample_rgba8(level_pixels.data(), level_width, level_height, next.data());
+			level_pixels.swap(next);
+		}
+	}
+}
+
+/* root mean square error of the finest level against the pixels it was encoded from */
+float texture_error(const EncodedTexture *encoded, const unsigned char *pixels) {
+	if (!texture_format_compressed(encoded->format)) {
+		return 0.0f;
+	}
+
+	size_t block_size = encoded->format == TEXTURE_FORMAT_BC1 ? 8 : 16;
+	const unsigned char *block = encoded->data.data();
+	unsigned char texels[16 * 4];
+	double sum = 0.0;
+
+	for (int by = 0; by < encoded->height; by += 4) {
+		for (int bx = 0; bx < encoded->width; bx += 4, block += block_size) {
+			decode_bc_block(encoded->format, block, texels);
+
+			for (int y = 0; y < 4 && by + y < encoded->height; ++y) {
+				for (int x = 0; x < 4 && bx + x < encoded->width; ++x) {
+					for (int c = 0; c < 4; ++c) {
+						int d = texels[(y * 4 + x) * 4 + c] - pixels[((by + y) * encoded->width + bx + x) * 4 + c];
+						sum += d * d;
+					}
+				}
+			}
+		}
+	}
+
+	return (float)sqrt(sum / ((double)encoded->width * encoded->height * 4));
+}
+
+std::string baked_texture_path(const char *source_path) {
+	return baked_path(source_path, ".tex");
+}
+
+bool write_texture(const char *path, const EncodedTexture *texture, uint64_t source_size, int64_t source_mtime) {
+	TextureHeader header = {};
+	header.magic = TEXTURE_MAGIC;
+	header.version = TEXTURE_VERSION;
+	header.source_size = source_size;
+	header.source_mtime = source_mtime;
+	header.format = texture->format;
+	header.width = texture->width;
+	header.height = texture->height;
+	header.level_count = texture->level_count;
+	header.data_offset = sizeof(TextureHeader);
+	header.data_size = texture->data.size();
+	memcpy(header.levels, texture->levels, sizeof(TextureLevel) * texture->level_count);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(texture->data.data(), 1, texture->data.size(), file);
+
+	return fclose(file) == 0;
+}
+
+/* the header if the file is a complete bake */
+const TextureHeader *texture_header(const VfsFile *file) {
+	if (file->size < sizeof(TextureHeader)) {
+		return 0;
+	}
+
+	const TextureHeader *header = (const TextureHeader *)file->data;
+	if (header->magic != TEXTURE_MAGIC || header->version != TEXTURE_VERSION) {
+		return 0;
+	}
+
+	if (header->format > TEXTURE_FORMAT_BC3 || header->width == 0 || header->height == 0) {
+		return 0;
+	}
+
+	if (header->level_count == 0 || header->level_count > TEXTURE_MAX_LEVELS || header->level_count > (uint32_t)mip_levels(header->width, header->height)) {
+		return 0;
+	}
+
+	if ((uint64_t)header->data_offset + header->data_size > file->size) {
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < header->level_count; ++i) {
+		const TextureLevel *level = &header->levels[i];
+		size_t expected = texture_level_size(header->format, std::max(header->width >> i, 1u), std::max(header->height >> i, 1u));
+		if (level->size != expected || (uint64_t)level->offset + level->size > header->data_size) {
+			return 0;
+		}
+	}
+
+	return header;
+}
+
+bool texture_is_stale(const TextureHeader *header, const char *source_path) {
+	return source_changed(source_path, header->source_size, header->source_mtime);
+}
+
+/*
+ * Opens the fresh bake of source_path, safe on any thread. file is that bake
+ * already read, which is taken over here, or null to open it.
+ */
+bool open_baked_texture(const char *source_path, VfsFile *file, BakedTexture *baked) {
+	std::string path = baked_texture_path(source_path);
+
+	if (file) {
+		baked->file = *file;
+		vfs_clear(file);
+		if (!baked->file.data) {
+			return false;
+		}
+	} else if (!vfs_open(path.c_str(), &baked->file)) {
+		return false;
+	}
+
+	baked->header = texture_header(&baked->file);
+	if (!baked->header) {
+		LOG(LOG_WARNING, "Ignoring invalid texture bake", log_str("path", path.c_str()));
+	} else if (texture_is_stale(baked->header, source_path)) {
+		LOG(LOG_WARNING, "Texture bake is stale, run Bake", log_str("path", path.c_str()));
+	} else if (!texture_format_supported(baked->header->format)) {
+		LOG(LOG_WARNING, "Texture bake format is not supported here", log_str("path", path.c_str()), log_str("format", texture_format_names[baked->header->format]));
+	} else {
+		baked->data = baked->file.data + baked->header->data_offset;
+		return true;
+	}
+
+	vfs_close(&baked->file);
+	return false;
+}
+
+void close_baked_texture(BakedTexture *baked) {
+	vfs_close(&baked->file);
+	baked->header = 0;
+	baked->data = 0;
+}
+
+/* opens the bakes of all layers of an array, which must agree on format, size and levels; files as for open_baked_texture */
+bool open_baked_textures(const char **source_paths, int count, VfsFile *files, BakedTexture *baked) {
+	int opened = 0;
+	while (opened < count && open_baked_texture(source_paths[opened], files ? &files[opened] : nullptr, &baked[opened])) {
+		opened++;
+	}
+
+	bool match = opened == count;
+	for (int i = 1; i < opened && match; ++i) {
+		const TextureHeader *a = baked[0].header, *b = baked[i].header;
+		match = a->format == b->format && a->width == b->width && a->height == b->height && a->level_count == b->level_count;
+		if (!match) {
+			LOG(LOG_WARNING, "Texture bakes of an array disagree, run Bake", log_str("path", source_paths[i]));
+		}
+	}
+
+	if (!match) {
+		for (int i = 0; i < opened; ++i) {
+			close_baked_texture(&baked[i]);
+		}
+	}
+
+	return match;
+}
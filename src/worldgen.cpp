@@ -0,0 +1,84 @@
+/*
+ * Procedural worlds for the benchmarks. They follow the same rules as the
+ * level files: ground cubes at y = 0, crates and walls one level above.
+ */
+void generate_world(Platformer *platformer, int size_x, int size_z, float crate_density, unsigned int seed) {
+	World *world = &platformer->world;
+	Player *player = &platformer->player;
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<float> chance(0.0f, 1.0f);
+
+	int player_x = size_x / 2;
+	int player_z = size_z / 2;
+
+	world->blocks.clear();
+	for (int z = 0; z < size_z; ++z) {
+		for (int x = 0; x < size_x; ++x) {
+			world->blocks.push_back(Block(x, 0, z, ID_CUBE));
+
+			bool border = x == 0 || z == 0 || x == size_x - 1 || z == size_z - 1;
+			if (border) {
+				world->blocks.push_back(Block(x, 1, z, ID_CUBE));
+			} else if ((x != player_x || z != player_z) && chance(random) < crate_density) {
+				world->blocks.push_back(Block(x, 1, z, ID_CRATE));
+			}
+		}
+	}
+
+	player->x = player_x;
+	player->z = player_z;
+	player->last_x = player->x;
+	player->last_z = player->z;
+
+	world->version++;
+}
+
+/* a flat floor with count crates dropped from heights between 2 and 6 */
+void generate_falling_crates(Platformer *platformer, int size, int count, unsigned int seed) {
+	World *world = &platformer->world;
+	std::mt19937 random(seed);
+
+	generate_world(platformer, size, size, 0.0f, seed);
+
+	std::vector<int> cells;
+	for (int z = 1; z < size - 1; ++z) {
+		for (int x = 1; x < size - 1; ++x) {
+			if (x != size / 2 || z != size / 2) {
+				cells.push_back(z * size + x);
+			}
+		}
+	}
+	std::shuffle(cells.begin(), cells.end(), random);
+
+	std::uniform_int_distribution<int> height(2, 6);
+	for (int i = 0; i < count && i < (int)cells.size(); ++i) {
+		Block crate(cells[i] % size, height(random), cells[i] / size, ID_CRATE);
+		crate.target_y = 1;
+		world->blocks.push_back(crate);
+	}
+
+	world->version++;
+}
+
+/* a small island in the middle of the water plane */
+void generate_island(Platformer *platformer, int size) {
+	World *world = &platformer->world;
+	Player *player = &platformer->player;
+
+	int start_x = (world_size_x - size) / 2;
+	int start_z = (world_size_z - size) / 2;
+
+	world->blocks.clear();
+	for (int z = start_z; z < start_z + size; ++z) {
+		for (int x = start_x; x < start_x + size; ++x) {
+			world->blocks.push_back(Block(x, 0, z, ID_CUBE));
+		}
+	}
+
+	player->x = start_x + size / 2;
+	player->z = start_z + size / 2;
+	player->last_x = player->x;
+	player->last_z = player->z;
+
+	world->version++;
+}